@@ -1,11 +1,27 @@
+#define _GNU_SOURCE
 #include <assert.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <fcntl.h>
 #include <string.h>
+#include <errno.h>
+#include <setjmp.h>
+#if !defined(__x86_64__)
+#include <ucontext.h>
+#endif
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 #include <netdb.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <sys/sysinfo.h>
 
 #include "iota-bootstrap.h"
 
@@ -13,55 +29,126 @@
 #define BUFFER_MAX 1024
 #endif
 
+#ifndef STREAM_BUFFER_SIZE
+#define STREAM_BUFFER_SIZE (64 * 1024)
+#endif
+
 #ifndef CONNECTIONS_MAX
 #define CONNECTIONS_MAX 1024
 #endif
 
+#ifndef WORKERS_MAX
+#define WORKERS_MAX 64
+#endif
+
+#ifndef FUEL_SLICE
+#define FUEL_SLICE 10000
+#endif
+
+#ifndef TASK_STACK_SIZE
+#define TASK_STACK_SIZE (8 * 1024 * 1024)
+#endif
+
+#ifndef EVAL_STACK_SIZE
+#define EVAL_STACK_SIZE (64 * 1024)
+#endif
+
+#define EVAL_STACK_BYTES (EVAL_STACK_SIZE * sizeof(object *))
+
+#ifndef DYNAMIC_MAX
+#define DYNAMIC_MAX 64
+#endif
+
+#ifndef DYNAMIC_DEPTH
+#define DYNAMIC_DEPTH 256
+#endif
+
+#ifndef SEQ_DEPTH_MAX
+#define SEQ_DEPTH_MAX 64
+#endif
+
+#ifndef TASK_STACK_POOL_MAX
+#define TASK_STACK_POOL_MAX 64
+#endif
+
+#ifndef DEQUE_SIZE_INITIAL
+#define DEQUE_SIZE_INITIAL 64
+#endif
+
+#ifndef FOLD_ARGS_MAX
+#define FOLD_ARGS_MAX 8
+#endif
+
+#ifndef INLINE_SIZE_MAX
+#define INLINE_SIZE_MAX 16
+#endif
+
+#ifndef INLINE_DEPTH_MAX
+#define INLINE_DEPTH_MAX 4
+#endif
+
+#ifndef JIT_THRESHOLD
+#define JIT_THRESHOLD 100
+#endif
+
+#ifndef JIT_ARENA_SIZE
+#define JIT_ARENA_SIZE (1024 * 1024)
+#endif
+
+#ifndef PROC_INFO_BUCKETS
+#define PROC_INFO_BUCKETS 1024
+#endif
+
 /************/
 /* language */
 /************/
 
-typedef struct object {
-  object_type type;
-  union {
-    struct {
-      char *value;
-    } symbol;
-    struct {
-      char *value;
-    } keyword;
-    struct {
-      long value;
-    } fixnum;
-    struct {
-      char value;
-    } character;
-    struct {
-      char *value;
-    } string;
-    struct {
-      struct object *first;
-      struct object *rest;
-    } cons;
-    struct {
-      struct object * (*fn)(struct object *args, struct object *env);
-    } primitive_proc;
-    struct {
-      struct object *parameters;
-      struct object *body;
-      struct object *env;
-    } compound_proc;
-    struct {
-      struct object *parameters;
-      struct object *body;
-      struct object *env;
-    } macro;
-    struct {
-      directiontype directiontype;
-      FILE* fp;
-    } stream;
-  } data;
-} object;
+object *nil;
+object *t_symbol;
+object *symbol_table;
+object *keyword_table;
+object *quote_symbol;
+object *backquote_symbol;
+object *comma_symbol;
+object *pipe_symbol;
+object *comma_at_symbol;
+object *define_symbol;
+object *set_symbol;
+object *if_symbol;
+object *cond_symbol;
+object *else_symbol;
+object *lambda_symbol;
+object *let_symbol;
+object *dynamic_let_symbol;
+object *while_symbol;
+object *loop_symbol;
+object *delay_symbol;
+object *begin_symbol;
+object *macro_symbol;
+object *future_symbol;
+object *bind_symbol;
+object *guard_symbol;
+// the constructors quasiquote code calls; held as objects so that
+// rebinding cons cannot change what a template builds
+object *quasi_cons;
+object *quasi_append;
+object *rest_keyword;
+object *eof_object;
+object *stdin_stream;
+object *stdout_stream;
+object *stdin_symbol;
+object *stdout_symbol;
+object *load_path_symbol;
+object *output_keyword;
+object *input_keyword;
+object *timeout_keyword;
+object *the_empty_environment;
+// the current context's, swapped with it
+__thread object *the_global_environment = NULL;
+
+// guards the symbol/keyword tables and frame growth once worker
+// threads are running futures
+pthread_mutex_t runtime_lock = PTHREAD_MUTEX_INITIALIZER;
 
 object *alloc_object() {
   object *obj;
@@ -71,7 +158,176 @@ object *alloc_object() {
   return obj;
 }
 
+// An escape point is a setjmp target plus the per-thread evaluator
+// state to put back when control unwinds to it.
+typedef struct escape {
+  jmp_buf jump;
+  struct budget *budget;
+  object **eval_sp;
+  long dynamic_sp;
+  long top_level_loops;
+} escape;
+
+// with-budget: fuel runs out once the step count reaches limit
+typedef struct budget {
+  escape escape;
+  long limit;
+  struct budget *outer;
+} budget;
+
+// fuel counts procedure calls and loop iterations left before
+// fuel_exhausted() checks budgets and preemption
+__thread long fuel = FUEL_SLICE;
+// how many top-level loops are running the body optimize() made of
+// them; the loops inside one are optimized already
+__thread long top_level_loops = 0;
+__thread long fuel_granted = FUEL_SLICE;
+__thread long fuel_base = 0;
+__thread budget *current_budget = NULL;
+
+// when a handler is installed (e.g. around a server client's form),
+// errors unwind to it instead of killing the process
+__thread escape *error_handler = NULL;
+__thread char error_message[BUFFER_MAX];
+
+// arguments to array primitives are evaluated onto this stack; a task
+// keeps its own at the low end of its stack mapping, other threads map
+// one on first use
+__thread object **eval_stack = NULL;
+__thread object **eval_sp = NULL;
+__thread object **eval_stack_limit = NULL;
+
+void eval_stack_init() {
+  eval_stack = mmap(NULL, EVAL_STACK_BYTES, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if(eval_stack == MAP_FAILED) {
+    eval_stack = NULL;
+    error("Could not allocate evaluator stack.");
+  }
+  eval_sp = eval_stack;
+  eval_stack_limit = eval_stack + EVAL_STACK_SIZE;
+}
+
+// where the next pushed argument will go
+object **eval_mark() {
+  if(!eval_stack)
+    eval_stack_init();
+  return eval_sp;
+}
+
+void eval_push(object *obj) {
+  if(eval_sp == eval_stack_limit)
+    error("Evaluator stack overflow.");
+  *eval_sp++ = obj;
+}
+
+// A dynamic variable such as *stdout* keeps its current value in a
+// per-thread slot, so reading it is an index rather than a walk to the
+// global frame; a parameter or let of the same name still shadows it,
+// as it would any global.  dynamic-let pushes the old slot contents on a
+// binding stack and puts them back when its body returns or an escape
+// unwinds past it.  An empty slot means the root (global) value is
+// current.  Every task has its own slots.
+typedef struct dynamic_binding {
+  long index;
+  object *saved;
+} dynamic_binding;
+
+typedef struct dynamic_state {
+  object *values[DYNAMIC_MAX];
+  dynamic_binding stack[DYNAMIC_DEPTH];
+  long sp;
+} dynamic_state;
+
+// Everything one interpreter instance owns.  Symbols, keywords and the
+// standard streams are shared; the global environment, the roots of
+// the dynamic variables and the modules loaded are not.
+struct iota_context {
+  object *global_environment;
+  object *dynamic_roots[DYNAMIC_MAX];
+  object *loaded_modules;       // by name, as require loaded them
+  escape *escape;               // where iota_eval unwinds to on error
+  char error_message[BUFFER_MAX];
+  _Atomic long futures;         // started here and not yet done
+  _Atomic long references;      // the handle's, and one per task and future
+};
+
+__thread iota_context *current_context = NULL;
+long dynamic_count = 0;
+__thread dynamic_state *dynamics = NULL;
+
+char is_dynamic(object *var) {
+  return var->data.symbol.dynamic != 0;
+}
+
+long dynamic_depth() {
+  return dynamics ? dynamics->sp : 0;
+}
+
+object *dynamic_value(object *var) {
+  long i = var->data.symbol.dynamic - 1;
+  object *value;
+
+  if(dynamics && (value = dynamics->values[i]))
+    return value;
+  return current_context->dynamic_roots[i];
+}
+
+// assigns the innermost binding, or the root when there is none
+void set_dynamic_value(object *var, object *val) {
+  long i = var->data.symbol.dynamic - 1;
+
+  if(dynamics && dynamics->values[i])
+    dynamics->values[i] = val;
+  else
+    current_context->dynamic_roots[i] = val;
+}
+
+void dynamic_bind(object *var, object *val) {
+  long i = var->data.symbol.dynamic - 1;
+  dynamic_binding *b;
+
+  if(!dynamics && !(dynamics = calloc(1, sizeof(dynamic_state))))
+    error("Could not allocate dynamic bindings.");
+  if(dynamics->sp == DYNAMIC_DEPTH)
+    error("Dynamic binding stack overflow.");
+  b = &dynamics->stack[dynamics->sp++];
+  b->index = i;
+  b->saved = dynamics->values[i];
+  dynamics->values[i] = val;
+}
+
+// pop bindings until depth are left
+void dynamic_unwind(long depth) {
+  dynamic_binding *b;
+
+  while(dynamics && dynamics->sp > depth) {
+    b = &dynamics->stack[--dynamics->sp];
+    dynamics->values[b->index] = b->saved;
+  }
+}
+
+void save_escape(escape *e) {
+  e->budget = current_budget;
+  e->eval_sp = eval_mark();
+  e->dynamic_sp = dynamic_depth();
+  e->top_level_loops = top_level_loops;
+}
+
+void restore_escape(escape *e) {
+  current_budget = e->budget;
+  eval_sp = e->eval_sp;
+  dynamic_unwind(e->dynamic_sp);
+  top_level_loops = e->top_level_loops;
+  fuel_refill();
+}
+
 void error(char *msg) {
+  if(error_handler) {
+    strncpy(error_message, msg, BUFFER_MAX - 1);
+    error_message[BUFFER_MAX - 1] = '\0';
+    longjmp(error_handler->jump, 1);
+  }
   fprintf(stderr,"%s\n",msg);
   exit(1);
 }
@@ -84,11 +340,14 @@ object *make_symbol(char *value) {
   object *obj;
   object *element;
 
+  pthread_mutex_lock(&runtime_lock);
   // search
   element = symbol_table;
   while(!is_nil(element)) {
-    if( strcmp(car(element)->data.symbol.value, value) == 0)
+    if( strcmp(car(element)->data.symbol.value, value) == 0) {
+      pthread_mutex_unlock(&runtime_lock);
       return car(element);
+    }
     element = cdr(element);
   }
 
@@ -96,9 +355,32 @@ object *make_symbol(char *value) {
   obj = alloc_object();
   obj->type = SYMBOL;
   obj->data.symbol.value = (char *) malloc(strlen(value) + 1);
-  if(!obj->data.symbol.value) return 0;
+  if(!obj->data.symbol.value) {
+    pthread_mutex_unlock(&runtime_lock);
+    return 0;
+  }
   strcpy(obj->data.symbol.value, value);
+  obj->data.symbol.version = 0;
+  obj->data.symbol.watched = 0;
+  obj->data.symbol.dynamic = 0;
+  obj->data.symbol.global_index = 0;
   symbol_table = cons(obj, symbol_table);
+  pthread_mutex_unlock(&runtime_lock);
+  return obj;
+}
+
+// left out of the symbol table so that source can never spell it; used
+// to tag forms only the optimizer makes
+object *make_uninterned_symbol(char *value) {
+  object *obj;
+
+  obj = alloc_object();
+  obj->type = SYMBOL;
+  obj->data.symbol.value = value;
+  obj->data.symbol.version = 0;
+  obj->data.symbol.watched = 0;
+  obj->data.symbol.dynamic = 0;
+  obj->data.symbol.global_index = 0;
   return obj;
 }
 
@@ -106,11 +388,14 @@ object *make_keyword(char *value) {
   object *obj;
   object *element;
 
+  pthread_mutex_lock(&runtime_lock);
   // search
   element = keyword_table;
   while(!is_nil(element)) {
-    if (strcmp(car(element)->data.keyword.value, value) == 0)
+    if (strcmp(car(element)->data.keyword.value, value) == 0) {
+      pthread_mutex_unlock(&runtime_lock);
       return car(element);
+    }
     element = cdr(element);
   }
 
@@ -118,10 +403,13 @@ object *make_keyword(char *value) {
   obj = alloc_object();
   obj->type = KEYWORD;
   obj->data.keyword.value = (char *) malloc(strlen(value) + 1);
-  if(!obj->data.keyword.value)
+  if(!obj->data.keyword.value) {
+    pthread_mutex_unlock(&runtime_lock);
     return 0;
+  }
   strcpy(obj->data.keyword.value, value);
   keyword_table = cons(obj, keyword_table);
+  pthread_mutex_unlock(&runtime_lock);
   return obj;
 }
 
@@ -164,7 +452,8 @@ object *make_string(char *value) {
 
   obj = alloc_object();
   obj->type = STRING;
-  obj->data.string.value = (char *) malloc(strlen(value) + 1);
+  obj->data.string.length = strlen(value);
+  obj->data.string.value = (char *) malloc(obj->data.string.length + 1);
   if (!obj->data.string.value)
     return 0;
   strcpy(obj->data.string.value, value);
@@ -172,6 +461,34 @@ object *make_string(char *value) {
   return obj;
 }
 
+// a string over length chars at start, which it shares rather than
+// copies; slices of another string are not NUL-terminated
+object *make_string_slice(char *start, long length) {
+  object *obj;
+
+  obj = alloc_object();
+  obj->type = STRING;
+  obj->data.string.value = start;
+  obj->data.string.length = length;
+  return obj;
+}
+
+// the contents as a C string, copying a slice the first time one is
+// asked for
+char *string_cstr(object *str) {
+  char *copy;
+
+  if(str->data.string.value[str->data.string.length] == '\0')
+    return str->data.string.value;
+  copy = malloc(str->data.string.length + 1);
+  if(!copy)
+    error("Could not allocate string.");
+  memcpy(copy, str->data.string.value, str->data.string.length);
+  copy[str->data.string.length] = '\0';
+  str->data.string.value = copy;
+  return copy;
+}
+
 char is_string(object *obj) {
   return obj->type == STRING;
 }
@@ -211,38 +528,542 @@ char is_input_stream(object *obj) {
   return is_stream(obj) && obj->data.stream.directiontype == INPUT;
 }
 
-object *make_file_stream(char* stream_name, directiontype direction) {
-  object *obj;
+/*********/
+/* tasks */
+/*********/
+
+// Green threads.  Each OS thread runs its own scheduler on its original
+// ("root") stack: tasks switch back to the root when they park, yield or
+// finish, and the root waits on epoll when nothing is runnable.
+typedef struct task {
+  void *sp;                     // saved stack pointer while switched out
+#if !defined(__x86_64__)
+  ucontext_t context;
+#endif
+  char *stack;
+  size_t stack_size;
+  void (*entry)(void *arg);
+  void *arg;
+  taskstate state;
+  struct task *next;            // run queue link
+  // task-local runtime state, swapped by task_switch
+  escape *error_handler;
+  long fuel;
+  long fuel_granted;
+  long fuel_base;
+  budget *budget;
+  dynamic_state *dynamics;
+  iota_context *context;
+  iota_context *home;           // made in; referenced until the task ends
+  object **eval_stack;
+  object **eval_sp;
+  object **eval_stack_limit;
+} task;
+
+typedef struct waiter {
+  task *task;
+  int events;
+  struct waiter *next;
+} waiter;
+
+__thread task root_task;
+__thread task *current_task = NULL;
+__thread task *run_queue_head = NULL;
+__thread task *run_queue_tail = NULL;
+__thread int tasks_count = 0;
+__thread int events_fd = -1;
+__thread waiter **fd_waiters = NULL;
+__thread int fd_waiters_size = 0;
+__thread int waiting_count = 0;
+__thread char *stack_pool[TASK_STACK_POOL_MAX];
+__thread int stack_pool_count = 0;
+
+#if defined(__x86_64__)
+// save callee-saved registers on the current stack, store its pointer
+// in *from_sp and resume the stack at to_sp
+void task_switch_stacks(void **from_sp, void *to_sp);
+__asm__(".text\n"
+        ".globl task_switch_stacks\n"
+        ".hidden task_switch_stacks\n"
+        ".type task_switch_stacks, @function\n"
+        "task_switch_stacks:\n"
+        "  pushq %rbp\n"
+        "  pushq %rbx\n"
+        "  pushq %r12\n"
+        "  pushq %r13\n"
+        "  pushq %r14\n"
+        "  pushq %r15\n"
+        "  movq %rsp, (%rdi)\n"
+        "  movq %rsi, %rsp\n"
+        "  popq %r15\n"
+        "  popq %r14\n"
+        "  popq %r13\n"
+        "  popq %r12\n"
+        "  popq %rbx\n"
+        "  popq %rbp\n"
+        "  ret\n");
+#endif
+
+task *this_task() {
+  if(!current_task)
+    current_task = &root_task;
+  return current_task;
+}
+
+void task_switch(task *from, task *to) {
+  from->error_handler = error_handler;
+  error_handler = to->error_handler;
+  from->fuel = fuel;
+  from->fuel_granted = fuel_granted;
+  from->fuel_base = fuel_base;
+  from->budget = current_budget;
+  fuel = to->fuel;
+  fuel_granted = to->fuel_granted;
+  fuel_base = to->fuel_base;
+  current_budget = to->budget;
+  from->eval_stack = eval_stack;
+  from->eval_sp = eval_sp;
+  from->eval_stack_limit = eval_stack_limit;
+  eval_stack = to->eval_stack;
+  eval_sp = to->eval_sp;
+  eval_stack_limit = to->eval_stack_limit;
+  from->dynamics = dynamics;
+  dynamics = to->dynamics;
+  from->context = current_context;
+  iota_enter(to->context);
+  current_task = to;
+#if defined(__x86_64__)
+  task_switch_stacks(&from->sp, to->sp);
+#else
+  swapcontext(&from->context, &to->context);
+#endif
+}
+
+void task_trampoline() {
+  task *self = current_task;
+
+  self->entry(self->arg);
+  self->state = TASK_DONE;
+  tasks_count--;
+  task_switch(self, &root_task);
+}
+
+task *make_task(void (*entry)(void *arg), void *arg) {
+  task *t;
+  void **sp;
+
+  this_task();
+  t = calloc(1, sizeof(task));
+  if(!t)
+    error("Could not allocate thread.");
+  // the mapping holds the evaluator stack, a guard page, then the C
+  // stack growing down towards the guard
+  t->stack_size = EVAL_STACK_BYTES + 4096 + TASK_STACK_SIZE;
+  if(stack_pool_count > 0) {
+    t->stack = stack_pool[--stack_pool_count];
+  }
+  else {
+    // reserve the whole stack but let the kernel commit pages as it
+    // grows
+    t->stack = mmap(NULL, t->stack_size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if(t->stack == MAP_FAILED)
+      error("Could not allocate thread stack.");
+    mprotect(t->stack + EVAL_STACK_BYTES, 4096, PROT_NONE);
+  }
+  t->eval_stack = t->eval_sp = (object **) t->stack;
+  t->eval_stack_limit = t->eval_stack + EVAL_STACK_SIZE;
+  t->entry = entry;
+  t->arg = arg;
+  t->fuel = t->fuel_granted = FUEL_SLICE;
+  t->context = t->home = current_context;
+  context_retain(t->home);
+#if defined(__x86_64__)
+  // six saved registers, then the "return address" of the first switch
+  sp = (void **) (t->stack + t->stack_size);
+  *--sp = NULL;
+  *--sp = (void *) task_trampoline;
+  sp -= 6;
+  memset(sp, 0, 6 * sizeof(void *));
+  t->sp = sp;
+#else
+  getcontext(&t->context);
+  t->context.uc_stack.ss_sp = t->stack + EVAL_STACK_BYTES + 4096;
+  t->context.uc_stack.ss_size = TASK_STACK_SIZE;
+  t->context.uc_link = NULL;
+  makecontext(&t->context, task_trampoline, 0);
+#endif
+  tasks_count++;
+  task_wake(t);
+  return t;
+}
+
+void free_task(task *t) {
+  if(stack_pool_count < TASK_STACK_POOL_MAX)
+    stack_pool[stack_pool_count++] = t->stack;
+  else
+    munmap(t->stack, t->stack_size);
+  context_release(t->home);
+  free(t->dynamics);
+  free(t);
+}
+
+void task_wake(task *t) {
+  t->state = TASK_RUNNABLE;
+  if(t == &root_task)
+    return;
+  t->next = NULL;
+  if(run_queue_tail)
+    run_queue_tail->next = t;
+  else
+    run_queue_head = t;
+  run_queue_tail = t;
+}
+
+task *next_runnable_task() {
+  task *t = run_queue_head;
+
+  if(t) {
+    run_queue_head = t->next;
+    if(!run_queue_head)
+      run_queue_tail = NULL;
+  }
+  return t;
+}
+
+// root only: give a task the processor until it parks, yields or ends
+void run_task(task *t) {
+  task_switch(&root_task, t);
+  if(t->state == TASK_DONE)
+    free_task(t);
+}
+
+char arm_fd(int fd) {
+  struct epoll_event ev;
+  waiter *w;
+
+  ev.events = EPOLLONESHOT;
+  for(w = fd_waiters[fd]; w; w = w->next)
+    ev.events |= w->events;
+  ev.data.fd = fd;
+  if(epoll_ctl(events_fd, EPOLL_CTL_MOD, fd, &ev) == 0)
+    return 1;
+  if(errno == ENOENT && epoll_ctl(events_fd, EPOLL_CTL_ADD, fd, &ev) == 0)
+    return 1;
+  // e.g. regular files, which are always ready
+  return 0;
+}
+
+void poll_events(int timeout) {
+  struct epoll_event events[64];
+  waiter **link, *w;
+  int n, i, fd;
+
+  n = epoll_wait(events_fd, events, 64, timeout);
+  for(i = 0; i < n; i++) {
+    fd = events[i].data.fd;
+    link = &fd_waiters[fd];
+    while((w = *link) != NULL) {
+      if(w->events & events[i].events || events[i].events & (EPOLLERR | EPOLLHUP)) {
+        *link = w->next;
+        waiting_count--;
+        task_wake(w->task);
+      }
+      else {
+        link = &w->next;
+      }
+    }
+    if(fd_waiters[fd])
+      arm_fd(fd);
+  }
+}
+
+// root only: run tasks and dispatch events until the root is woken.
+// Each pass gives only the tasks runnable at its start a turn, so
+// events are polled between passes even while some task stays busy.
+void run_scheduler() {
+  task *t;
+  int n;
+
+  while(root_task.state != TASK_RUNNABLE) {
+    if(waiting_count > 0)
+      poll_events(run_queue_head ? 0 : -1);
+    else if(!run_queue_head)
+      error("Deadlock: every thread is waiting.");
+    for(n = 0, t = run_queue_head; t; t = t->next)
+      n++;
+    while(n-- > 0 && root_task.state != TASK_RUNNABLE &&
+          (t = next_runnable_task()) != NULL)
+      run_task(t);
+  }
+}
+
+void task_park() {
+  task *self = this_task();
+
+  self->state = TASK_PARKED;
+  if(self == &root_task)
+    run_scheduler();
+  else
+    task_switch(self, &root_task);
+}
+
+void task_yield() {
+  task *self = this_task();
+  task *t;
+  int n;
+
+  if(self != &root_task) {
+    task_wake(self);
+    task_switch(self, &root_task);
+    return;
+  }
+  // the root gives everything currently runnable one turn
+  if(waiting_count > 0)
+    poll_events(0);
+  for(n = 0, t = run_queue_head; t; t = t->next)
+    n++;
+  while(n-- > 0 && (t = next_runnable_task()) != NULL)
+    run_task(t);
+}
+
+void wait_for_fd(int fd, int events) {
+  task *self = this_task();
+  struct pollfd pfd;
+  waiter w;
+  int size;
+
+  if(self == &root_task && tasks_count == 0) {
+    // nothing else to run: just block
+    pfd.fd = fd;
+    pfd.events = events;
+    poll(&pfd, 1, -1);
+    return;
+  }
+  if(events_fd < 0 && (events_fd = epoll_create1(0)) < 0)
+    error("Could not create event loop.");
+  if(fd >= fd_waiters_size) {
+    size = fd_waiters_size ? fd_waiters_size : 64;
+    while(size <= fd)
+      size *= 2;
+    fd_waiters = realloc(fd_waiters, size * sizeof(waiter *));
+    if(!fd_waiters)
+      error("Could not grow event table.");
+    memset(fd_waiters + fd_waiters_size, 0, (size - fd_waiters_size) * sizeof(waiter *));
+    fd_waiters_size = size;
+  }
+  w.task = self;
+  w.events = events;
+  w.next = fd_waiters[fd];
+  fd_waiters[fd] = &w;
+  if(!arm_fd(fd)) {
+    fd_waiters[fd] = w.next;
+    return;
+  }
+  waiting_count++;
+  task_park();
+}
+
+/********/
+/* fuel */
+/********/
+
+long fuel_steps() {
+  return fuel_base + (fuel_granted - fuel);
+}
+
+// grant the next slice, cut short by the innermost budget
+void fuel_refill() {
+  long now = fuel_steps();
+  long grant = FUEL_SLICE;
+
+  if(current_budget && current_budget->limit - now < grant)
+    grant = current_budget->limit - now;
+  if(grant < 0)
+    grant = 0;
+  fuel_base = now;
+  fuel_granted = fuel = grant;
+}
+
+// end of a slice: expire the outermost spent budget, or let other
+// green threads run
+void fuel_exhausted() {
+  budget *b, *spent = NULL;
+  long now = fuel_steps();
+
+  for(b = current_budget; b; b = b->outer) {
+    if(now >= b->limit)
+      spent = b;
+  }
+  if(spent)
+    longjmp(spent->escape.jump, 1);
+  // tasks parked on fds need the root to poll for them
+  if(run_queue_head || waiting_count > 0)
+    task_yield();
+  fuel_refill();
+}
+
+object *with_budget(long steps, object *thunk, object *env) {
+  budget b;
+  escape *volatile saved_handler = error_handler;
+  object *volatile result;
+
+  save_escape(&b.escape);
+  b.outer = current_budget;
+  b.limit = fuel_steps() + steps;
+  if(b.outer && b.outer->limit < b.limit)
+    b.limit = b.outer->limit;
+  current_budget = &b;
+  fuel_refill();
+  if(setjmp(b.escape.jump) == 0) {
+    result = apply(thunk, nil, env);
+  }
+  else {
+    error_handler = saved_handler;
+    result = timeout_keyword;
+  }
+  restore_escape(&b.escape);
+  return result;
+}
+
+object *with_budget_proc(object *args, object *env) {
+  assert( is_list(args) );
+  assert( is_fixnum(car(args)) );
+  return with_budget(car(args)->data.fixnum.value, cadr(args), env);
+}
+
+// <unistd.h> would clash with read/write below, so descriptors are
+// moved with readv/writev and closed through stdio
+void close_fd(int fd) {
+  FILE *fp = fdopen(fd, "r");
+  if(fp)
+    fclose(fp);
+}
+
+typedef struct fd_stream {
   int fd;
+  char nonblocking;
+} fd_stream;
+
+// a read or write that would block parks the current green thread until
+// the event loop reports the descriptor ready
+ssize_t fd_stream_read(void *cookie, char *buf, size_t size) {
+  fd_stream *fds = cookie;
+  struct iovec iov = {buf, size};
+  ssize_t n;
+
+  if(!fds->nonblocking && tasks_count > 0)
+    wait_for_fd(fds->fd, EPOLLIN);
+  while(1) {
+    n = readv(fds->fd, &iov, 1);
+    if(n >= 0)
+      return n;
+    if(errno == EAGAIN || errno == EWOULDBLOCK)
+      wait_for_fd(fds->fd, EPOLLIN);
+    else if(errno != EINTR)
+      return -1;
+  }
+}
+
+ssize_t fd_stream_write(void *cookie, const char *buf, size_t size) {
+  fd_stream *fds = cookie;
+  struct iovec iov = {(char *) buf, size};
+  ssize_t n;
+  size_t done = 0;
+
+  while(done < size) {
+    iov.iov_base = (char *) buf + done;
+    iov.iov_len = size - done;
+    n = writev(fds->fd, &iov, 1);
+    if(n >= 0)
+      done += n;
+    else if(errno == EAGAIN || errno == EWOULDBLOCK)
+      wait_for_fd(fds->fd, EPOLLOUT);
+    else if(errno != EINTR)
+      return done > 0 ? done : -1;
+  }
+  return done;
+}
+
+int fd_stream_close(void *cookie) {
+  fd_stream *fds = cookie;
+
+  if(fds->fd > 2)
+    close_fd(fds->fd);
+  free(fds);
+  return 0;
+}
+
+FILE *fd_stream_open(int fd, directiontype direction) {
+  fd_stream *fds;
+  cookie_io_functions_t io = {fd_stream_read, fd_stream_write, NULL, fd_stream_close};
+
+  fds = malloc(sizeof(fd_stream));
+  if(!fds)
+    return NULL;
+  fds->fd = fd;
+  fds->nonblocking = (fcntl(fd, F_GETFL) & O_NONBLOCK) != 0;
+  return fopencookie(fds, direction == INPUT ? "r" : "w", io);
+}
+
+object *make_fd_stream(int fd, directiontype direction) {
+  object *obj;
+
+  obj = alloc_object();
+  obj->type = STREAM;
+  obj->data.stream.directiontype = direction;
+  obj->data.stream.buffer = NULL;
+  obj->data.stream.size = 0;
+  obj->data.stream.fp = fd_stream_open(fd, direction);
+  if(!obj->data.stream.fp)
+    error("Could not open stream.");
+  return obj;
+}
+
+// a stream over a FILE the caller opened
+object *make_stdio_stream(FILE *fp, directiontype direction) {
+  object *obj;
 
   obj = alloc_object();
   obj->type = STREAM;
+  obj->data.stream.fp = fp;
+  obj->data.stream.directiontype = direction;
+  obj->data.stream.buffer = NULL;
+  obj->data.stream.size = 0;
+  return obj;
+}
+
+object *make_file_stream(char* stream_name, directiontype direction) {
+  object *obj;
+  int fd;
 
   if(strcmp(stream_name, "stdin") == 0 ) {
-    obj->data.stream.fp = stdin;
-    obj->data.stream.directiontype = INPUT;
-    return obj;
-  }
-  if (strcmp(stream_name, "stdout") == 0) {
-    obj->data.stream.fp = stdout;
-    obj->data.stream.directiontype = OUTPUT;
+    obj = make_fd_stream(0, INPUT);
+    // line buffered so that pending prompts are flushed before reading
+    setvbuf(obj->data.stream.fp, NULL, _IOLBF, BUFFER_MAX);
     return obj;
   }
+  if (strcmp(stream_name, "stdout") == 0)
+    return make_stdio_stream(stdout, OUTPUT);
   if (direction == INPUT) {
-    obj->data.stream.directiontype = INPUT;
     fd = open(stream_name, O_RDONLY | O_CREAT | O_NONBLOCK, S_IRUSR | S_IWUSR);
-    obj->data.stream.fp = fdopen(fd, "r");
   }
   else {
-    obj->data.stream.directiontype = OUTPUT;
     fd = open(stream_name, O_WRONLY | O_CREAT, S_IRUSR | S_IWUSR);
-    obj->data.stream.fp = fdopen(fd, "w");
+    // set after opening: a non-blocking open of a FIFO with no reader fails
+    if(fd >= 0)
+      fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
   }
-  if(!fd || !obj->data.stream.fp) {
+  if(fd < 0) {
     error("Could not open file stream.");
   }
-  // turn off buffering
-  setvbuf(obj->data.stream.fp, NULL, _IONBF, 0);
+  obj = make_fd_stream(fd, direction);
+  // input is read a buffer at a time; output goes out unbuffered so
+  // that it is visible as soon as it is written
+  if(direction == INPUT)
+    setvbuf(obj->data.stream.fp, NULL, _IOFBF, STREAM_BUFFER_SIZE);
+  else
+    setvbuf(obj->data.stream.fp, NULL, _IONBF, 0);
   return obj;
 }
 
@@ -252,6 +1073,57 @@ void close_stream(object *stream) {
   fclose(stream->data.stream.fp);
 }
 
+// String ports are stdio memory streams: output lands in a buffer that
+// grows as needed and input is read out of the string's own chars, so
+// neither side makes a system call.
+object *make_output_string_stream() {
+  object *obj;
+
+  obj = alloc_object();
+  obj->type = STREAM;
+  obj->data.stream.directiontype = OUTPUT;
+  obj->data.stream.buffer = NULL;
+  obj->data.stream.size = 0;
+  obj->data.stream.fp = open_memstream(&obj->data.stream.buffer,
+                                       &obj->data.stream.size);
+  if(!obj->data.stream.fp)
+    error("Could not open stream.");
+  return obj;
+}
+
+object *make_input_string_stream(object *str) {
+  object *obj;
+
+  obj = alloc_object();
+  obj->type = STREAM;
+  obj->data.stream.directiontype = INPUT;
+  obj->data.stream.buffer = NULL;
+  obj->data.stream.size = 0;
+  obj->data.stream.fp = fmemopen(str->data.string.value,
+                                 str->data.string.length, "r");
+  if(!obj->data.stream.fp)
+    error("Could not open stream.");
+  return obj;
+}
+
+// what has been written to an output string stream so far
+object *output_string(object *stream) {
+  char *chars;
+
+  if(!is_stream(stream) || stream->data.stream.directiontype != OUTPUT ||
+     stream->data.stream.fp == stdout)
+    error("Not an output string stream.");
+  fflush(stream->data.stream.fp);
+  if(!stream->data.stream.buffer)
+    error("Not an output string stream.");
+  chars = malloc(stream->data.stream.size + 1);
+  if(!chars)
+    error("Could not allocate string.");
+  memcpy(chars, stream->data.stream.buffer, stream->data.stream.size);
+  chars[stream->data.stream.size] = '\0';
+  return make_string_slice(chars, stream->data.stream.size);
+}
+
 // get length of list
 // linear time! use sparingly.
 long len(object *obj) {
@@ -273,9 +1145,53 @@ object *make_primitive_proc(object *(*fn)(struct object *args, struct object *en
   obj = alloc_object();
   obj->type = PRIMITIVE_PROC;
   obj->data.primitive_proc.fn = fn;
+  obj->data.primitive_proc.array_fn = NULL;
+  obj->data.primitive_proc.min_args = 0;
+  obj->data.primitive_proc.max_args = -1;
+  return obj;
+}
+
+// a primitive that takes its arguments as a slice of the evaluator
+// stack; max_args is -1 for no limit
+object *make_array_primitive_proc(object *(*array_fn)(struct object **args,
+                                                      long argc,
+                                                      struct object *env),
+                                  int min_args, int max_args) {
+  object *obj;
+
+  obj = alloc_object();
+  obj->type = PRIMITIVE_PROC;
+  obj->data.primitive_proc.fn = NULL;
+  obj->data.primitive_proc.array_fn = array_fn;
+  obj->data.primitive_proc.min_args = min_args;
+  obj->data.primitive_proc.max_args = max_args;
   return obj;
 }
 
+object *call_array_primitive(object *proc, object **args, long argc,
+                             object *env) {
+  if(argc < proc->data.primitive_proc.min_args ||
+     (proc->data.primitive_proc.max_args >= 0 &&
+      argc > proc->data.primitive_proc.max_args))
+    error("Wrong number of arguments.");
+  return (proc->data.primitive_proc.array_fn)(args, argc, env);
+}
+
+// an array primitive reached with an argument list, e.g. through apply
+object *apply_array_primitive(object *proc, object *args, object *env) {
+  object **base = eval_mark();
+  object *result;
+  long argc = 0;
+
+  for(; !is_nil(args); args = cdr(args)) {
+    eval_push(car(args));
+    argc++;
+  }
+  result = call_array_primitive(proc, base, argc, env);
+  eval_sp = base;
+  return result;
+}
+
 char is_primitive_proc(object *obj) {
   return obj->type == PRIMITIVE_PROC;
 }
@@ -285,13 +1201,12 @@ object *error_proc(object *args, object *env) {
   object *msg;
   msg = car(args);
   assert( is_string(msg) );
-  error(msg->data.string.value);
+  error(string_cstr(msg));
   return nil;
 }
 
-object *is_null_proc(object *args, object *env) {
-  assert( is_list(args) );
-  return is_nil(car(args)) ? t_symbol : nil;
+object *is_null_proc(object **args, long argc, object *env) {
+  return is_nil(args[0]) ? t_symbol : nil;
 }
 
 object *is_list_proc(object *args, object *env) {
@@ -382,24 +1297,42 @@ object *number_to_string_proc(object *args, object *env) {
 object *string_to_number_proc(object *args, object *env) {
   assert( is_list(args) );
   assert( is_string(car(args)) );
-  long num = 0;
+  long num = 0, i = 0, sign = 1;
   char *cptr = car(args)->data.string.value;
+  long length = car(args)->data.string.length;
 
-  while(cptr) {
-    num = (num / 10) + (*cptr++ - '0');
+  if(length > 1 && cptr[0] == '-') {
+    sign = -1;
+    i++;
+  }
+  if(i == length)
+    return nil;
+  for(; i < length; i++) {
+    if(!isdigit(cptr[i]))
+      return nil;
+    num = num * 10 + (cptr[i] - '0');
   }
+  return make_fixnum(num * sign);
 }
 
 object *concat_proc(object *args, object *env) {
   assert( is_list(args) );
-  char new_string[BUFFER_MAX];
   object *strobj1, *strobj2;
+  long length1, length2;
+  char *new_string;
   strobj1 = car(args);
   strobj2 = cadr(args);
+  assert( is_string(strobj1) && is_string(strobj2) );
 
-  strcpy(new_string, strobj1->data.string.value);
-  strcat(new_string, strobj2->data.string.value);
-  return make_string(new_string);
+  length1 = strobj1->data.string.length;
+  length2 = strobj2->data.string.length;
+  new_string = malloc(length1 + length2 + 1);
+  if(!new_string)
+    error("Could not allocate string.");
+  memcpy(new_string, strobj1->data.string.value, length1);
+  memcpy(new_string + length1, strobj2->data.string.value, length2);
+  new_string[length1 + length2] = '\0';
+  return make_string_slice(new_string, length1 + length2);
 }
 
 object *symbol_to_string_proc(object *args, object *env) {
@@ -411,131 +1344,263 @@ object *symbol_to_string_proc(object *args, object *env) {
 object *string_to_symbol_proc(object *args, object *env) {
   assert( is_list(args) );
   assert( is_string(car(args)) );
-  return make_symbol(car(args)->data.string.value);
+  return make_symbol(string_cstr(car(args)));
+}
+
+// Scanning primitives hand back slices of their argument, so splitting
+// a large buffer into fields copies no characters.
+
+object *string_length_proc(object **args, long argc, object *env) {
+  if(!is_string(args[0]))
+    error("Not a string.");
+  return make_fixnum(args[0]->data.string.length);
+}
+
+// a fixnum argument as an index in [0, limit]
+long string_position(object *obj, long limit) {
+  if(!is_fixnum(obj) || obj->data.fixnum.value < 0 ||
+     obj->data.fixnum.value > limit)
+    error("String index out of range.");
+  return obj->data.fixnum.value;
+}
+
+// (substring string start [end])
+object *substring_proc(object **args, long argc, object *env) {
+  long start, end;
+
+  if(!is_string(args[0]))
+    error("Not a string.");
+  end = argc > 2 ? string_position(args[2], args[0]->data.string.length) :
+    args[0]->data.string.length;
+  start = string_position(args[1], end);
+  return make_string_slice(args[0]->data.string.value + start, end - start);
+}
+
+// where needle, a character or a string, first occurs in the length
+// chars at start; NULL when it does not
+char *string_search(char *start, long length, object *needle) {
+  if(is_character(needle))
+    return memchr(start, needle->data.character.value, length);
+  if(is_string(needle))
+    return memmem(start, length, needle->data.string.value,
+                  needle->data.string.length);
+  error("Not a character or string.");
+  return NULL;
+}
+
+// (string-index string needle [start]): nil when needle does not occur
+object *string_index_proc(object **args, long argc, object *env) {
+  long start;
+  char *found;
+
+  if(!is_string(args[0]))
+    error("Not a string.");
+  start = argc > 2 ? string_position(args[2], args[0]->data.string.length) : 0;
+  found = string_search(args[0]->data.string.value + start,
+                        args[0]->data.string.length - start, args[1]);
+  return found ? make_fixnum(found - args[0]->data.string.value) : nil;
+}
+
+// (string-split string separator): every field, empty ones included
+object *string_split_proc(object **args, long argc, object *env) {
+  object *result = nil, *last = nil;
+  char *field, *end, *found;
+  long step;
+
+  if(!is_string(args[0]))
+    error("Not a string.");
+  step = is_string(args[1]) ? args[1]->data.string.length : 1;
+  if(step == 0)
+    error("Empty separator.");
+  field = args[0]->data.string.value;
+  end = field + args[0]->data.string.length;
+  while((found = string_search(field, end - field, args[1]))) {
+    list_append_item(&result, &last, make_string_slice(field, found - field));
+    field = found + step;
+  }
+  list_append_item(&result, &last, make_string_slice(field, end - field));
+  return result;
 }
 
-object *add_proc(object *args, object *env) {
-  assert( is_list(args) );
-  long result = 0;
-
-  while (!is_nil(args)) {
-    assert( is_fixnum(car(args)) );
-    result += (car(args))->data.fixnum.value;
-    args = cdr(args);
-  }
-  return make_fixnum(result);
+// (string-prefix? prefix string)
+object *string_prefix_proc(object **args, long argc, object *env) {
+  if(!is_string(args[0]) || !is_string(args[1]))
+    error("Not a string.");
+  return args[0]->data.string.length <= args[1]->data.string.length &&
+    memcmp(args[0]->data.string.value, args[1]->data.string.value,
+           args[0]->data.string.length) == 0 ? t_symbol : nil;
 }
 
-object *subtract_proc(object *args, object *env) {
-  assert( is_list(args) );
-  long result = car(args)->data.fixnum.value;
-  args = cdr(args);
+// A string builder appends into a buffer that doubles as it fills and
+// hands that buffer over as the finished string.
+object *make_string_builder_proc(object **args, long argc, object *env) {
+  object *obj;
 
-  while(!is_nil(args)) {
-    assert( is_fixnum(car(args)) );
-    result -= (car(args))->data.fixnum.value;
-    args = cdr(args);
-  }
-  return make_fixnum(result);
+  obj = alloc_object();
+  obj->type = STRING_BUILDER;
+  obj->data.string_builder.buffer = NULL;
+  obj->data.string_builder.length = 0;
+  obj->data.string_builder.capacity = 0;
+  return obj;
 }
 
-object *multiply_proc(object *args, object *env) {
-  assert( is_list(args) );
+char is_string_builder(object *obj) {
+  return obj->type == STRING_BUILDER;
+}
+
+void string_builder_append(object *builder, char *chars, long length) {
+  long capacity = builder->data.string_builder.capacity;
+  char *buffer;
+
+  if(builder->data.string_builder.length + length + 1 > capacity) {
+    while(builder->data.string_builder.length + length + 1 > capacity)
+      capacity = capacity * 2 + 16;
+    buffer = realloc(builder->data.string_builder.buffer, capacity);
+    if(!buffer)
+      error("Could not allocate string.");
+    builder->data.string_builder.buffer = buffer;
+    builder->data.string_builder.capacity = capacity;
+  }
+  memcpy(builder->data.string_builder.buffer +
+         builder->data.string_builder.length, chars, length);
+  builder->data.string_builder.length += length;
+}
+
+// (string-builder-append! builder piece ...): strings and characters
+object *string_builder_append_proc(object **args, long argc, object *env) {
+  long i;
+
+  if(!is_string_builder(args[0]))
+    error("Not a string builder.");
+  for(i = 1; i < argc; i++) {
+    if(is_string(args[i]))
+      string_builder_append(args[0], args[i]->data.string.value,
+                            args[i]->data.string.length);
+    else if(is_character(args[i]))
+      string_builder_append(args[0], &args[i]->data.character.value, 1);
+    else
+      error("Not a character or string.");
+  }
+  return args[0];
+}
+
+// the builder starts over empty afterwards
+object *string_builder_to_string_proc(object **args, long argc,
+                                      object *env) {
+  object *builder = args[0];
+  object *str;
+
+  if(!is_string_builder(builder))
+    error("Not a string builder.");
+  string_builder_append(builder, "", 0);
+  builder->data.string_builder.buffer[builder->data.string_builder.length] = '\0';
+  str = make_string_slice(builder->data.string_builder.buffer,
+                          builder->data.string_builder.length);
+  builder->data.string_builder.buffer = NULL;
+  builder->data.string_builder.length = 0;
+  builder->data.string_builder.capacity = 0;
+  return str;
+}
+
+object *add_proc(object **args, long argc, object *env) {
+  long result = 0;
+  long i;
+
+  for(i = 0; i < argc; i++) {
+    assert( is_fixnum(args[i]) );
+    result += args[i]->data.fixnum.value;
+  }
+  return make_fixnum(result);
+}
+
+object *subtract_proc(object **args, long argc, object *env) {
+  long result = args[0]->data.fixnum.value;
+  long i;
+
+  for(i = 1; i < argc; i++) {
+    assert( is_fixnum(args[i]) );
+    result -= args[i]->data.fixnum.value;
+  }
+  return make_fixnum(result);
+}
+
+object *multiply_proc(object **args, long argc, object *env) {
   long result = 1;
+  long i;
 
-  while(!is_nil(args)) {
-    assert( is_fixnum(car(args)) );
-    result *= car(args)->data.fixnum.value;
-    args = cdr(args);
+  for(i = 0; i < argc; i++) {
+    assert( is_fixnum(args[i]) );
+    result *= args[i]->data.fixnum.value;
   }
   return make_fixnum(result);
 }
 
-object *divide_proc(object *args, object *env) {
-  assert( is_list(args) );
-  assert( is_fixnum(car(args)) );
-  long result = car(args)->data.fixnum.value;
-  args = cdr(args);
+object *divide_proc(object **args, long argc, object *env) {
+  assert( is_fixnum(args[0]) );
+  long result = args[0]->data.fixnum.value;
+  long i;
 
-  while(!is_nil(args)) {
-    assert( is_fixnum(car(args)) );
-    result /= car(args)->data.fixnum.value;
-    args = cdr(args);
+  for(i = 1; i < argc; i++) {
+    assert( is_fixnum(args[i]) );
+    result /= args[i]->data.fixnum.value;
   }
   return make_fixnum(result);
 }
 
-object *is_equal_proc(object *args, object *env) {
-  assert( is_list(args) );
-  assert( is_fixnum(car(args)) );
-  long value;
+object *is_equal_proc(object **args, long argc, object *env) {
+  assert( is_fixnum(args[0]) );
+  long i;
 
-  value = car(args)->data.fixnum.value;
-  while (!is_nil(args = cdr(args))) {
-    assert( is_fixnum(car(args)) );
-    if (value != (car(args)->data.fixnum.value))
+  for(i = 1; i < argc; i++) {
+    assert( is_fixnum(args[i]) );
+    if(args[0]->data.fixnum.value != args[i]->data.fixnum.value)
       return nil;
   }
   return t_symbol;
 }
 
-object *is_less_than_proc(object *args, object *env) {
-  assert( is_list(args) );
-  long previous, next;
-
-  previous = car(args)->data.fixnum.value;
-  while( !is_nil(args = cdr(args)) ) {
-    assert( is_fixnum(car(args)) );
-    next = car(args)->data.fixnum.value;
-    if(previous < next)
-      previous = next;
-    else
+object *is_less_than_proc(object **args, long argc, object *env) {
+  long i;
+
+  for(i = 1; i < argc; i++) {
+    assert( is_fixnum(args[i]) );
+    if(!(args[i - 1]->data.fixnum.value < args[i]->data.fixnum.value))
       return nil;
   }
   return t_symbol;
 }
 
-object *is_greater_than_proc(object *args, object *env) {
-  assert( is_list(args) );
-  long previous, next;
-
-  previous = car(args)->data.fixnum.value;
-  while(!is_nil(args = cdr(args))) {
-    assert( is_fixnum(car(args)) );
-    next = car(args)->data.fixnum.value;
-    if (previous > next)
-      previous = next;
-    else
+object *is_greater_than_proc(object **args, long argc, object *env) {
+  long i;
+
+  for(i = 1; i < argc; i++) {
+    assert( is_fixnum(args[i]) );
+    if(!(args[i - 1]->data.fixnum.value > args[i]->data.fixnum.value))
       return nil;
   }
   return t_symbol;
 }
 
-object *cons_proc(object *args, object *env) {
-  assert( is_list(args) );
-  return cons(car(args), cadr(args));
+object *cons_proc(object **args, long argc, object *env) {
+  return cons(args[0], args[1]);
 }
 
-object *car_proc(object *args, object *env) {
-  assert( is_list(args) );
-  return caar(args);
+object *car_proc(object **args, long argc, object *env) {
+  return car(args[0]);
 }
 
-object *cdr_proc(object *args, object *env) {
-  assert( is_list(args) );
-  return cdar(args);
+object *cdr_proc(object **args, long argc, object *env) {
+  return cdr(args[0]);
 }
 
-object *set_car_proc(object *args, object *env) {
-  assert( is_list(args) );
-  car(car(args)) = cadr(args);
-  return cadr(args);
+object *set_car_proc(object **args, long argc, object *env) {
+  car(args[0]) = args[1];
+  return args[1];
 }
 
-object *set_cdr_proc(object *args, object *env) {
-  assert( is_list(args) );
-  cdr(car(args)) = cadr(args);
-  return cadr(args);
+object *set_cdr_proc(object **args, long argc, object *env) {
+  cdr(args[0]) = args[1];
+  return args[1];
 }
 
 object *list_proc(object *args, object *env) {
@@ -543,9 +1608,8 @@ object *list_proc(object *args, object *env) {
   return args;
 }
 
-object *len_proc(object *args, object *env) {
-  assert( is_list(args) );
-  return make_fixnum(len(car(args)));
+object *len_proc(object **args, long argc, object *env) {
+  return make_fixnum(len(args[0]));
 }
 
 char is_eq(object *obj1, object *obj2) {
@@ -561,8 +1625,9 @@ char is_eq(object *obj1, object *obj2) {
             obj2->data.character.value);
     break;
   case STRING:
-    return (strcmp(obj1->data.string.value,
-                   obj2->data.string.value) == 0);
+    return obj1->data.string.length == obj2->data.string.length &&
+      memcmp(obj1->data.string.value, obj2->data.string.value,
+             obj1->data.string.length) == 0;
     break;
   default:
     return (obj1 == obj2);
@@ -570,14 +1635,8 @@ char is_eq(object *obj1, object *obj2) {
   }
 }
 
-object *is_eq_proc(object *args, object *env) {
-  assert( is_list(args) );
-  object *obj1, *obj2;
-
-  obj1 = car(args);
-  obj2 = cadr(args);
-
-  return is_eq(obj1, obj2) ? t_symbol : nil;
+object *is_eq_proc(object **args, long argc, object *env) {
+  return is_eq(args[0], args[1]) ? t_symbol : nil;
 }
 
 object *reverse(object *head) {
@@ -596,6 +1655,116 @@ object *reverse_proc(object *args, object *env) {
   return reverse(car(args));
 }
 
+// The list library below walks its lists in C loops, calling back
+// into procedures through apply, so a long list costs neither
+// interpreter frames nor C stack per element.
+
+void list_append_item(object **head, object **last, object *item) {
+  object *cell = cons(item, nil);
+
+  if(is_nil(*head))
+    *head = cell;
+  else
+    (*last)->data.cons.rest = cell;
+  *last = cell;
+}
+
+object *call_procedure(object *proc, object *args, object *env) {
+  consume_fuel();
+  return apply(proc, args, env);
+}
+
+// the heads of count lists as an argument list, advancing each list;
+// NULL once any of them runs out
+object *next_arguments(object **lists, long count) {
+  object *args = nil, *last = nil;
+  long i;
+
+  for(i = 0; i < count; i++)
+    if(!is_cons(lists[i]))
+      return NULL;
+  for(i = 0; i < count; i++) {
+    list_append_item(&args, &last, car(lists[i]));
+    lists[i] = cdr(lists[i]);
+  }
+  return args;
+}
+
+// (map f list ...): stops at the shortest list
+object *map_proc(object **args, long argc, object *env) {
+  object *result = nil, *last = nil, *call_args;
+
+  while((call_args = next_arguments(args + 1, argc - 1)))
+    list_append_item(&result, &last,
+                     call_procedure(args[0], call_args, env));
+  return result;
+}
+
+object *for_each_proc(object **args, long argc, object *env) {
+  object *call_args;
+
+  while((call_args = next_arguments(args + 1, argc - 1)))
+    call_procedure(args[0], call_args, env);
+  return nil;
+}
+
+object *filter_proc(object **args, long argc, object *env) {
+  object *result = nil, *last = nil, *list;
+
+  for(list = args[1]; is_cons(list); list = cdr(list))
+    if(!is_nil(call_procedure(args[0], cons(car(list), nil), env)))
+      list_append_item(&result, &last, car(list));
+  return result;
+}
+
+// (fold f init list): (f x acc) over the elements left to right
+object *fold_proc(object **args, long argc, object *env) {
+  object *acc = args[1], *list;
+
+  for(list = args[2]; is_cons(list); list = cdr(list))
+    acc = call_procedure(args[0], cons(car(list), cons(acc, nil)), env);
+  return acc;
+}
+
+// copies every list but the last, which the result shares
+object *append_proc(object **args, long argc, object *env) {
+  object *result = nil, *last = nil, *list;
+  long i;
+
+  if(argc == 0)
+    return nil;
+  for(i = 0; i < argc - 1; i++) {
+    for(list = args[i]; is_cons(list); list = cdr(list))
+      list_append_item(&result, &last, car(list));
+    if(!is_nil(list))
+      error("Not a list.");
+  }
+  if(is_nil(result))
+    return args[argc - 1];
+  last->data.cons.rest = args[argc - 1];
+  return result;
+}
+
+// (assoc key alist): the first pair whose car is eq? to key
+object *assoc_proc(object **args, long argc, object *env) {
+  object *list;
+
+  for(list = args[1]; is_cons(list); list = cdr(list))
+    if(is_cons(car(list)) && is_eq(caar(list), args[0]))
+      return car(list);
+  return nil;
+}
+
+// (member item list): the tail of list starting at item
+object *member_proc(object **args, long argc, object *env) {
+  object *list;
+
+  for(list = args[1]; is_cons(list); list = cdr(list))
+    if(is_eq(car(list), args[0]))
+      return list;
+  return nil;
+}
+
 object *make_file_stream_proc(object *args, object *env) {
   assert( is_list(args) );
   object *name, *dtype;
@@ -604,7 +1773,7 @@ object *make_file_stream_proc(object *args, object *env) {
   assert( is_string(name) );
   assert( is_keyword(dtype) );
   
-  return make_file_stream(name->data.string.value,
+  return make_file_stream(string_cstr(name),
                           is_eq(dtype, output_keyword) ? OUTPUT : INPUT);
 }
 
@@ -619,6 +1788,108 @@ object *close_stream_proc(object *args, object *env) {
   return t_symbol;
 }
 
+// Character, line and byte I/O goes straight to the stream's stdio
+// buffer, bypassing the reader and the write dispatch.  The stream
+// argument is optional and defaults to *stdin* or *stdout*.
+
+FILE *stream_arg(object **args, long argc, long i, directiontype direction,
+                 object *env) {
+  object *stream;
+
+  if(i < argc)
+    stream = args[i];
+  else
+    stream = lookup_variable_value(direction == INPUT ? stdin_symbol :
+                                   stdout_symbol, env);
+  if(!is_stream(stream) || stream->data.stream.directiontype != direction)
+    error(direction == INPUT ? "Not an input stream." :
+          "Not an output stream.");
+  return stream->data.stream.fp;
+}
+
+object *read_char_proc(object **args, long argc, object *env) {
+  int c = getc(stream_arg(args, argc, 0, INPUT, env));
+
+  return c == EOF ? eof_object : make_character(c);
+}
+
+object *peek_char_proc(object **args, long argc, object *env) {
+  int c = peek(stream_arg(args, argc, 0, INPUT, env));
+
+  return c == EOF ? eof_object : make_character(c);
+}
+
+// the next line without its newline; the buffer getline fills becomes
+// the string
+object *read_line_proc(object **args, long argc, object *env) {
+  char *line = NULL;
+  size_t size = 0;
+  ssize_t length;
+
+  length = getline(&line, &size, stream_arg(args, argc, 0, INPUT, env));
+  if(length < 0) {
+    free(line);
+    return eof_object;
+  }
+  if(length > 0 && line[length - 1] == '\n')
+    line[--length] = '\0';
+  return make_string_slice(line, length);
+}
+
+// (read-bytes n [stream]): up to n bytes as a string
+object *read_bytes_proc(object **args, long argc, object *env) {
+  FILE *in;
+  char *buffer;
+  size_t length;
+
+  if(!is_fixnum(args[0]) || args[0]->data.fixnum.value < 0)
+    error("Not a byte count.");
+  in = stream_arg(args, argc, 1, INPUT, env);
+  buffer = malloc(args[0]->data.fixnum.value + 1);
+  if(!buffer)
+    error("Could not allocate string.");
+  length = fread(buffer, 1, args[0]->data.fixnum.value, in);
+  if(length == 0 && args[0]->data.fixnum.value > 0) {
+    free(buffer);
+    return eof_object;
+  }
+  buffer[length] = '\0';
+  return make_string_slice(buffer, length);
+}
+
+object *write_string_proc(object **args, long argc, object *env) {
+  if(!is_string(args[0]))
+    error("Not a string.");
+  fwrite(args[0]->data.string.value, 1, args[0]->data.string.length,
+         stream_arg(args, argc, 1, OUTPUT, env));
+  return t_symbol;
+}
+
+object *write_char_proc(object **args, long argc, object *env) {
+  if(!is_character(args[0]))
+    error("Not a character.");
+  putc(args[0]->data.character.value, stream_arg(args, argc, 1, OUTPUT, env));
+  return t_symbol;
+}
+
+object *open_output_string_proc(object **args, long argc, object *env) {
+  return make_output_string_stream();
+}
+
+object *open_input_string_proc(object **args, long argc, object *env) {
+  if(!is_string(args[0]))
+    error("Not a string.");
+  return make_input_string_stream(args[0]);
+}
+
+object *get_output_string_proc(object **args, long argc, object *env) {
+  return output_string(args[0]);
+}
+
+object *is_eof_proc(object **args, long argc, object *env) {
+  return args[0] == eof_object ? t_symbol : nil;
+}
+
 object *make_compound_proc(object *params,
                            object *body,
                            object *env) {
@@ -628,7 +1899,9 @@ object *make_compound_proc(object *params,
   obj->type = COMPOUND_PROC;
   obj->data.compound_proc.parameters = params;
   obj->data.compound_proc.body = body;
-  obj->data.compound_proc.env = env;
+  obj->data.compound_proc.env = capture_environment(env);
+  obj->data.compound_proc.info = NULL;
+  describe_params(params, &obj->data.compound_proc.params);
 
   return obj;
 }
@@ -637,102 +1910,268 @@ char is_compound_proc(object *obj) {
   return obj->type == COMPOUND_PROC;
 }
   
-object *enclosing_environment(object *env) {
-  assert( is_list(env) );
-  return cdr(env);
-}
-
-object *first_frame(object *env) {
-  assert( is_list(env) );
-  return car(env);
-}
+// A frame is one allocation: the object header followed by its
+// initial bindings.  Growing it (a define inside a body, or the global
+// frame) moves the bindings to a larger array; the count is published
+// after the binding so that lock-free readers never see a half-made
+// slot.
+void init_frame(object *obj, object *parent, long capacity) {
+  obj->type = FRAME;
+  obj->data.frame.parent = parent;
+  obj->data.frame.bindings = (binding *) (obj + 1);
+  obj->data.frame.count = 0;
+  obj->data.frame.capacity = capacity;
+  obj->data.frame.region = 0;
+  obj->data.frame.promoted = NULL;
+}
+
+object *make_frame(object *parent, long capacity) {
+  object *obj;
 
-object *make_frame(object *variables, object *values) {
-  return cons(variables, values);
+  obj = malloc(sizeof(object) + capacity * sizeof(binding));
+  if(!obj)
+    error("Could not allocate frame.");
+  init_frame(obj, parent, capacity);
+  return obj;
 }
 
-object *frame_variables(object *frame) {
-  assert( is_list(frame) );
-  return car(frame);
+char is_environment(object *obj) {
+  return obj->type == FRAME || obj->type == NIL;
 }
 
-object *frame_values(object *frame) {
-  assert( is_list(frame) );
-  return cdr(frame);
+object *enclosing_environment(object *env) {
+  assert( is_environment(env) );
+  return env->data.frame.parent;
 }
 
 void add_binding_to_frame(object *var,
                           object *val,
                           object *frame) {
-  car(frame) = cons(var, car(frame) );
-  cdr(frame) = cons(val, cdr(frame) );
+  binding *bindings = frame->data.frame.bindings;
+  long count = frame->data.frame.count;
+  long capacity = frame->data.frame.capacity;
+
+  if(count == capacity) {
+    // the old array is left alone; a reader may still be scanning it
+    capacity = capacity * 2 + 4;
+    bindings = malloc(capacity * sizeof(binding));
+    if(!bindings)
+      error("Could not allocate frame.");
+    memcpy(bindings, frame->data.frame.bindings, count * sizeof(binding));
+  }
+  bindings[count].name = var;
+  bindings[count].value = val;
+  frame->data.frame.capacity = capacity;
+  __atomic_store_n(&frame->data.frame.bindings, bindings, __ATOMIC_RELEASE);
+  __atomic_store_n(&frame->data.frame.count, count + 1, __ATOMIC_RELEASE);
+  if(frame == the_global_environment && var->type == SYMBOL)
+    __atomic_store_n(&var->data.symbol.global_index, count + 1,
+                     __ATOMIC_RELEASE);
 }
 
 object *extend_environment(object *vars,
                            object *vals,
                            object *base_env) {
-  assert( is_list(base_env) );
-  return cons(make_frame(vars, vals), base_env); 
+  assert( is_environment(base_env) );
+  object *frame = make_frame(base_env, len(vars));
+
+  for(; !is_nil(vars) && !is_nil(vals); vars = cdr(vars), vals = cdr(vals))
+    add_binding_to_frame(car(vars), car(vals), frame);
+  return frame;
 }
 
-object *lookup_variable_value(object *var, object *env) {
-  assert( is_list(env) );
-  object *frame, *vars, *vals;
+// required arguments fill the descriptor's slots in order and the
+// rest, if any, are listed into the last one
+void fill_frame(object *frame, param_descriptor *d, object *args) {
+  assert( is_list(args) );
+  binding *slot = frame->data.frame.bindings;
+  long i;
+
+  for(i = 0; i < d->required; i++, slot++) {
+    if(is_nil(args))
+      error("Wrong number of arguments.");
+    slot->name = d->slots[i];
+    slot->value = car(args);
+    args = cdr(args);
+  }
+  if(d->rest) {
+    slot->name = d->slots[i];
+    slot->value = args;
+  }
+  frame->data.frame.count = d->count;
+}
+
+object *bind_frame(param_descriptor *d, object *args, object *base_env) {
+  object *frame = make_frame(base_env, d->count);
+
+  fill_frame(frame, d, args);
+  return frame;
+}
+
+// a call frame carved from the evaluator stack, popped by the caller
+// resetting eval_sp; on overflow it goes to the heap instead
+object *bind_region_frame(param_descriptor *d, object *args,
+                          object *base_env) {
+  object **base = eval_mark();
+  long words;
+  object *frame;
+
+  words = (sizeof(object) + d->count * sizeof(binding) + sizeof(object *) - 1)
+    / sizeof(object *);
+  if(eval_stack_limit - base < words)
+    return bind_frame(d, args, base_env);
+  frame = (object *) base;
+  eval_sp = base + words;
+  init_frame(frame, base_env, d->count);
+  frame->data.frame.region = 1;
+  fill_frame(frame, d, args);
+  return frame;
+}
+
+// closures, macros and futures keep their environment past the call
+// that made it, so any region frame in it moves to the heap first.  The
+// region frame is pointed at the same bindings, which keeps set! on
+// either side visible to the other.
+object *capture_environment(object *env) {
+  object *frame, *parent;
+  binding *bindings;
+  long count;
+
+  if(is_nil(env))
+    return env;
+  if(!env->data.frame.region) {
+    // a bind frame may hang off a region frame
+    parent = capture_environment(env->data.frame.parent);
+    if(parent != env->data.frame.parent)
+      env->data.frame.parent = parent;
+    return env;
+  }
+  if(env->data.frame.promoted)
+    return env->data.frame.promoted;
+  count = env->data.frame.count;
+  bindings = malloc(count * sizeof(binding));
+  if(count && !bindings)
+    error("Could not allocate frame.");
+  memcpy(bindings, env->data.frame.bindings, count * sizeof(binding));
+  frame = make_frame(capture_environment(env->data.frame.parent), 0);
+  frame->data.frame.bindings = bindings;
+  frame->data.frame.count = count;
+  frame->data.frame.capacity = count;
+  env->data.frame.bindings = bindings;
+  env->data.frame.capacity = count;
+  env->data.frame.promoted = frame;
+  return frame;
+}
+
+binding *find_binding(object *var, object *env) {
+  binding *bindings;
+  long i, count;
+
   while(!is_nil(env)) {
-    frame = first_frame(env);
-    vars = frame_variables(frame);
-    vals = frame_values(frame);
-    while(!is_nil(vars)) {
-      if(var == car(vars))
-        return car(vals);
-      vars = cdr(vars);
-      vals = cdr(vals);
+    count = __atomic_load_n(&env->data.frame.count, __ATOMIC_ACQUIRE);
+    bindings = __atomic_load_n(&env->data.frame.bindings, __ATOMIC_ACQUIRE);
+    // a symbol remembers where a global frame last put it; every
+    // context defines the builtins in the same order, so the slot is
+    // usually right in the others too
+    if(env == the_global_environment && var->type == SYMBOL) {
+      i = __atomic_load_n(&var->data.symbol.global_index, __ATOMIC_ACQUIRE);
+      if(!i)
+        return NULL;
+      if(i <= count && bindings[i - 1].name == var)
+        return &bindings[i - 1];
     }
-    env = enclosing_environment(env);
+    // newest first, as recent definitions tend to be the hot ones
+    for(i = count - 1; i >= 0; i--)
+      if(bindings[i].name == var)
+        return &bindings[i];
+    env = env->data.frame.parent;
+  }
+  return NULL;
+}
+
+// var's binding in env's frames short of the global one: a parameter
+// or let of a dynamic variable's name shadows the dynamic binding
+binding *lexical_binding(object *var, object *env) {
+  binding *bindings;
+  long i;
+
+  for(; !is_nil(env) && env != the_global_environment;
+      env = env->data.frame.parent) {
+    bindings = __atomic_load_n(&env->data.frame.bindings, __ATOMIC_ACQUIRE);
+    for(i = __atomic_load_n(&env->data.frame.count, __ATOMIC_ACQUIRE) - 1;
+        i >= 0; i--)
+      if(bindings[i].name == var)
+        return &bindings[i];
   }
-  error("Unbound variable.");
+  return NULL;
+}
+
+object *lookup_variable_value(object *var, object *env) {
+  assert( is_environment(env) );
+  object *value;
+  binding *b;
+
+  if(is_dynamic(var)) {
+    if((b = lexical_binding(var, env)))
+      return b->value;
+    // made dynamic by another context but never defined in this one
+    if(!(value = dynamic_value(var)))
+      error("Unbound variable.");
+    return value;
+  }
+  b = find_binding(var, env);
+  if(!b)
+    error("Unbound variable.");
+  return b->value;
 }
 
 void set_variable_value(object *var,
                         object *val,
                         object *env) {
-  assert( is_list(env)  );
-  object *frame, *vars, *vals;
-  while(!is_nil(env)) {
-    frame = first_frame(env);
-    vars = frame_variables(frame);
-    vals = frame_values(frame);
-    while(!is_nil(vars)) {
-      if(var == car(vars)) {
-        car(vals) = val;
-        return;
-      }
-      vars = cdr(vars);
-      vals = cdr(vals);
-    }
-    env = enclosing_environment(env);
+  assert( is_environment(env)  );
+  binding *b;
+
+  if(is_dynamic(var)) {
+    if((b = lexical_binding(var, env)))
+      b->value = val;
+    else
+      set_dynamic_value(var, val);
+    return;
   }
-  error("Unbound variable.");
+  jit_note_binding(var);
+  b = find_binding(var, env);
+  if(!b)
+    error("Unbound variable.");
+  b->value = val;
+  if(b >= the_global_environment->data.frame.bindings &&
+     b < the_global_environment->data.frame.bindings +
+     the_global_environment->data.frame.count)
+    note_global_binding(var);
 }
 
 void define_variable(object *var,
                      object *val,
                      object *env) {
-  assert( is_list(env) );
-  object *frame, *vars, *vals;
-  frame = first_frame(env);
-  vars = frame_variables(frame);
-  vals = frame_values(frame);
-
-  while(!is_nil(vars)) {
-    if(var == car(vars)) {
-      car(vals) = val;
-      return;
-    }
-    vars = cdr(vars);
-    vals = cdr(vals);
-  }
-  add_binding_to_frame(var, val, frame);
+  assert( is_environment(env) );
+  binding *bindings;
+  long i;
+
+  jit_note_binding(var);
+  if(env == the_global_environment && is_dynamic(var))
+    current_context->dynamic_roots[var->data.symbol.dynamic - 1] = val;
+  pthread_mutex_lock(&runtime_lock);
+  bindings = env->data.frame.bindings;
+  for(i = 0; i < env->data.frame.count; i++)
+    if(bindings[i].name == var)
+      break;
+  if(i < env->data.frame.count)
+    bindings[i].value = val;
+  else
+    add_binding_to_frame(var, val, env);
+  pthread_mutex_unlock(&runtime_lock);
+  // the new version is only published once the value is in place
+  if(env == the_global_environment)
+    note_global_binding(var);
 }
 
 object *setup_environment() {
@@ -749,7 +2188,8 @@ object *global_environment_proc(object *args, object *env) {
 }
 
 
-void init() {
+// the symbols, keywords and streams every context shares
+void init_runtime() {
   nil = alloc_object();
   nil->type = NIL;
 
@@ -769,14 +2209,38 @@ void init() {
   else_symbol = make_symbol("else");
   lambda_symbol = make_symbol("lambda");
   let_symbol = make_symbol("let");
+  dynamic_let_symbol = make_symbol("dynamic-let");
+  while_symbol = make_symbol("while");
+  loop_symbol = make_symbol("loop");
+  delay_symbol = make_symbol("delay");
   begin_symbol = make_symbol("begin");
   macro_symbol = make_symbol("macro");
+  future_symbol = make_symbol("future");
+  quasi_cons = make_array_primitive_proc(cons_proc, 2, 2);
+  quasi_append = make_array_primitive_proc(splice_proc, 2, 2);
+  bind_symbol = make_uninterned_symbol("bind");
+  guard_symbol = make_uninterned_symbol("guard");
   rest_keyword = make_keyword(":rest");
   output_keyword = make_keyword(":output");
+  timeout_keyword = make_keyword(":timeout");
   input_keyword = make_keyword(":input");
 
   the_empty_environment = nil;
+  jit_init();
+
+  eof_object = make_character(EOF);
+  stdin_stream = make_file_stream("stdin", INPUT);
+  stdout_stream = make_file_stream("stdout", OUTPUT);
+  stdin_symbol = make_symbol("*stdin*");
+  stdout_symbol = make_symbol("*stdout*");
+  load_path_symbol = make_symbol("*load-path*");
+}
+
+// a fresh global environment for the current context, holding the
+// builtins; every context defines them in the same order
+void init_globals() {
   the_global_environment = setup_environment();
+  current_context->global_environment = the_global_environment;
 
   define_variable(make_symbol("nil"),
                   nil,
@@ -785,11 +2249,8 @@ void init() {
                   t_symbol,
                   the_global_environment);
 
-  eof_object = make_character(EOF);
-  stdin_stream = make_file_stream("stdin", INPUT);
-  stdout_stream = make_file_stream("stdout", OUTPUT);
-  stdin_symbol = make_symbol("*stdin*");
-  stdout_symbol = make_symbol("*stdout*");
+  make_dynamic(stdin_symbol);
+  make_dynamic(stdout_symbol);
   define_variable(stdin_symbol,
                   stdin_stream,
                   the_global_environment);
@@ -798,8 +2259,8 @@ void init() {
                   the_global_environment);
 
   add_procedure("error"        , error_proc          );
-  add_procedure("null?"        , is_null_proc        );
-  add_procedure("nil?"         , is_null_proc        );
+  add_array_procedure("null?"        , is_null_proc        , 1, 1);
+  add_array_procedure("nil?"         , is_null_proc        , 1, 1);
   add_procedure("symbol?"      , is_symbol_proc      );
   add_procedure("keyword?"     , is_keyword_proc     );
   add_procedure("integer?"     , is_integer_proc     );
@@ -818,25 +2279,40 @@ void init() {
   add_procedure("string->symbol" , string_to_symbol_proc );
 
   add_procedure("strcat", concat_proc);
-
-  add_procedure("+" , add_proc             );
-  add_procedure("-" , subtract_proc        );
-  add_procedure("*" , multiply_proc        );
-  add_procedure("/" , divide_proc          );
-  add_procedure("=" , is_equal_proc        );
-  add_procedure("<" , is_less_than_proc    );
-  add_procedure(">" , is_greater_than_proc );
-
-  add_procedure("cons"     , cons_proc    );
-  add_procedure("car"      , car_proc     );
-  add_procedure("cdr"      , cdr_proc     );
-  add_procedure("set-car!" , set_car_proc );
-  add_procedure("set-cdr!" , set_cdr_proc );
+  add_array_procedure("string-length"  , string_length_proc  , 1, 1);
+  add_array_procedure("substring"      , substring_proc      , 2, 3);
+  add_array_procedure("string-index"   , string_index_proc   , 2, 3);
+  add_array_procedure("string-split"   , string_split_proc   , 2, 2);
+  add_array_procedure("string-prefix?" , string_prefix_proc  , 2, 2);
+  add_array_procedure("make-string-builder"    , make_string_builder_proc     , 0, 0);
+  add_array_procedure("string-builder-append!" , string_builder_append_proc   , 1, -1);
+  add_array_procedure("string-builder->string" , string_builder_to_string_proc, 1, 1);
+
+  add_array_procedure("+" , add_proc             , 0, -1);
+  add_array_procedure("-" , subtract_proc        , 1, -1);
+  add_array_procedure("*" , multiply_proc        , 0, -1);
+  add_array_procedure("/" , divide_proc          , 1, -1);
+  add_array_procedure("=" , is_equal_proc        , 1, -1);
+  add_array_procedure("<" , is_less_than_proc    , 1, -1);
+  add_array_procedure(">" , is_greater_than_proc , 1, -1);
+
+  add_array_procedure("cons"     , cons_proc    , 2, 2);
+  add_array_procedure("car"      , car_proc     , 1, 1);
+  add_array_procedure("cdr"      , cdr_proc     , 1, 1);
+  add_array_procedure("set-car!" , set_car_proc , 2, 2);
+  add_array_procedure("set-cdr!" , set_cdr_proc , 2, 2);
   add_procedure("list"     , list_proc    );
-  add_procedure("len"      , len_proc     );
+  add_array_procedure("len"      , len_proc     , 1, 1);
   add_procedure("reverse"  , reverse_proc );
-
-  add_procedure("eq?", is_eq_proc);
+  add_array_procedure("map"      , map_proc     , 2, -1);
+  add_array_procedure("for-each" , for_each_proc, 2, -1);
+  add_array_procedure("filter"   , filter_proc  , 2, 2);
+  add_array_procedure("fold"     , fold_proc    , 3, 3);
+  add_array_procedure("append"   , append_proc  , 0, -1);
+  add_array_procedure("assoc"    , assoc_proc   , 2, 2);
+  add_array_procedure("member"   , member_proc  , 2, 2);
+
+  add_array_procedure("eq?", is_eq_proc, 2, 2);
   
   add_procedure("macroexpand" , macroexpand_proc        );
   add_procedure("apply"       , apply_proc              );
@@ -844,113 +2320,424 @@ void init() {
   add_procedure("read"        , read_proc               );
   add_procedure("write"       , write_proc              );
   add_procedure("global-env"  , global_environment_proc );
+  add_procedure("make-dynamic", make_dynamic_proc       );
 
   add_procedure("make-file-stream"   , make_file_stream_proc   );
   add_procedure("close-stream"       , close_stream_proc       );
-}
+  add_array_procedure("read-char"    , read_char_proc    , 0, 1);
+  add_array_procedure("peek-char"    , peek_char_proc    , 0, 1);
+  add_array_procedure("read-line"    , read_line_proc    , 0, 1);
+  add_array_procedure("read-bytes"   , read_bytes_proc   , 1, 2);
+  add_array_procedure("write-string" , write_string_proc , 1, 2);
+  add_array_procedure("write-char"   , write_char_proc   , 1, 2);
+  add_array_procedure("eof?"         , is_eof_proc       , 1, 1);
+  add_array_procedure("write-fasl"   , write_fasl_proc   , 1, 2);
+  add_array_procedure("read-fasl"    , read_fasl_proc    , 0, 1);
+  add_array_procedure("open-output-string" , open_output_string_proc , 0, 0);
+  add_array_procedure("open-input-string"  , open_input_string_proc  , 1, 1);
+  add_array_procedure("get-output-string"  , get_output_string_proc  , 1, 1);
+
+  define_variable(load_path_symbol,
+                  cons(make_string("."), nil),
+                  the_global_environment);
+  add_array_procedure("load"    , load_proc    , 1, 1);
+  add_array_procedure("require" , require_proc , 1, 1);
 
-/********/
-/* read */
-/********/
+  add_procedure("touch"   , touch_proc     );
+  add_procedure("future?" , is_future_proc );
 
-char is_delimiter(int c) {
-  return isspace(c) || c == EOF || c == '(' || c == ')' || c == '"' || c == ';';
+  add_procedure("with-budget"  , with_budget_proc  );
+  add_procedure("spawn"        , spawn_proc        );
+  add_procedure("yield"        , yield_proc        );
+  add_procedure("make-channel" , make_channel_proc );
+  add_procedure("channel?"     , is_channel_proc   );
+  add_procedure("send"         , send_proc         );
+  add_procedure("recv"         , recv_proc         );
+
+  add_array_procedure("force"      , force_proc      , 1, 1);
+  add_array_procedure("seq"        , seq_proc        , 1, 1);
+  add_array_procedure("seq-map"    , seq_map_proc    , 2, 2);
+  add_array_procedure("seq-filter" , seq_filter_proc , 2, 2);
+  add_array_procedure("seq-take"   , seq_take_proc   , 2, 2);
+  add_array_procedure("seq-fold"   , seq_fold_proc   , 3, 3);
+  add_array_procedure("seq->list"  , seq_to_list_proc, 1, 1);
+
+  add_procedure("jit-stats" , jit_stats_proc );
 }
 
-char is_initial(int c) {
-  return isalpha(c) || c == '*' || c == '/' || c == '>' ||
-    c == '<' || c == '=' || c == '?' || c == '!';
+void init() {
+  iota_enter(iota_open());
 }
 
-int peek(FILE *in) {
-  int c;
+/************/
+/* contexts */
+/************/
 
-  c = getc(in);
-  ungetc(c, in);
-  return c;
-}
+// An embedder can run several isolated interpreters in one process:
+// each context gets its own globals, and evaluating in one returns NULL
+// with iota_error() set instead of exiting when something fails.  A
+// thread works in one context at a time; tasks and futures keep the
+// context they were started in.  The public API is in iota.h.
 
-void eat_whitespace(FILE *in) {
-  int c;
+pthread_once_t runtime_once = PTHREAD_ONCE_INIT;
 
-  while( (c = getc(in)) != EOF ) {
-    if (isspace(c))
-      continue;
-    else if (c == ';') {
-      while( (c = getc(in) != EOF) && (c != '\n') );
-      continue;
-    }
-    ungetc(c, in);
-    break;
-  }
+iota_context *iota_open(void) {
+  iota_context *saved = current_context;
+  iota_context *ctx;
+
+  if(!(ctx = calloc(1, sizeof(iota_context))))
+    return NULL;
+  pthread_once(&runtime_once, init_runtime);
+  ctx->loaded_modules = nil;
+  atomic_store(&ctx->references, 1);
+  iota_enter(ctx);
+  init_globals();
+  iota_enter(saved);
+  return ctx;
 }
 
-object *read_pair(object *in_stream, object *env) {
-  FILE *in;
-  int c;
+void context_retain(iota_context *ctx) {
+  if(ctx)
+    atomic_fetch_add(&ctx->references, 1);
+}
 
-  object *first_obj;
-  object *rest_obj;
+void context_release(iota_context *ctx) {
+  if(ctx && atomic_fetch_sub(&ctx->references, 1) == 1)
+    free(ctx);
+}
 
-  if(in_stream == stdin_stream)
-    in_stream = eval(stdin_symbol, env);
-  in = in_stream->data.stream.fp;
+// A task still parked once the context is drained (on a channel, or on
+// another thread) keeps its reference, and the last one to end frees
+// ctx.
+void iota_close(iota_context *ctx) {
+  drain_context(ctx);
+  if(current_context == ctx)
+    iota_enter(NULL);
+  context_release(ctx);
+}
 
-  eat_whitespace(in);
+// make ctx the context this thread (or task) works in
+void iota_enter(iota_context *ctx) {
+  current_context = ctx;
+  the_global_environment = ctx ? ctx->global_environment : NULL;
+}
 
-  c = getc(in);
-  if(c == ')')
-    return nil;
-  ungetc(c, in);
-  
-  first_obj = read(in_stream, env);
+// why the last call into ctx returned NULL
+char *iota_error(iota_context *ctx) {
+  return ctx->error_message;
+}
 
-  eat_whitespace(in);
+// fn(arg) in ctx; an error unwinds to the jump buffer ctx records and
+// comes back as NULL.  Calls nest, each restoring the one outside it.
+object *context_run(iota_context *ctx, object *(*fn)(void *arg), void *arg) {
+  iota_context *volatile saved_context = current_context;
+  escape *volatile saved_handler = error_handler;
+  escape *volatile outer = ctx->escape;
+  object *volatile result = NULL;
+  escape handler;
 
-  c = getc(in);
-  if (c == '.') {
-    c = peek(in);
-    if (!is_delimiter(c)) {
-      error("Dot not followed by delimiter");
-    }
-    rest_obj = read(in_stream, env);
-    eat_whitespace(in);
-    c = getc(in);
-    if (c != ')') {
-      error("Unclosed list.");
-    }
-    return cons(first_obj, rest_obj);
+  iota_enter(ctx);
+  save_escape(&handler);
+  ctx->escape = &handler;
+  error_handler = &handler;
+  if(setjmp(handler.jump) == 0) {
+    result = fn(arg);
+    ctx->error_message[0] = '\0';
   }
   else {
-    ungetc(c, in);
-    rest_obj = read_pair(in_stream, env);
-    return cons(first_obj, rest_obj);
+    restore_escape(&handler);
+    strcpy(ctx->error_message, error_message);
   }
+  ctx->escape = outer;
+  error_handler = saved_handler;
+  iota_enter(saved_context);
+  return result;
 }
 
-object *read(object *in_stream, object *env) {
-  FILE *in;
-  int c;
-  int i;
-  short sign = 1;
-  long num = 0;
-  char character;
-  char buffer[BUFFER_MAX];
-  char error_msg[BUFFER_MAX];
+object *run_eval(void *exp) {
+  return eval(exp, the_global_environment);
+}
 
-  if(in_stream == stdin_stream)
-    in_stream = eval(stdin_symbol, env);
-  
-  in = in_stream->data.stream.fp;
+// every form on the stream, giving the last value
+object *run_stream(void *stream) {
+  object *exp, *result = nil;
 
-  eat_whitespace(in);
+  while((exp = read(stream, the_global_environment)) != eof_object)
+    result = eval(exp, the_global_environment);
+  return result;
+}
 
-  c = getc(in);
+object *run_string(void *source) {
+  object *text, *stream, *result;
 
-  if(c == EOF)
-    return eof_object;
-  else if(c == '#') {
-    character = getc(in);
+  text = make_string_slice(source, strlen(source));
+  stream = make_input_string_stream(text);
+  result = run_stream(stream);
+  close_stream(stream);
+  return result;
+}
+
+object *run_load(void *file_name) {
+  load_file(file_name);
+  return t_symbol;
+}
+
+// (proc . args)
+object *run_call(void *arg) {
+  object *call = arg;
+
+  return apply(car(call), cdr(call), the_global_environment);
+}
+
+object *iota_eval(iota_context *ctx, object *exp) {
+  return context_run(ctx, run_eval, exp);
+}
+
+object *iota_eval_string(iota_context *ctx, const char *source) {
+  return context_run(ctx, run_string, (void *) source);
+}
+
+// in is left open
+object *iota_eval_stream(iota_context *ctx, FILE *in) {
+  return context_run(ctx, run_stream, make_stdio_stream(in, INPUT));
+}
+
+object *iota_load(iota_context *ctx, const char *file_name) {
+  return context_run(ctx, run_load, (void *) file_name);
+}
+
+object *iota_call(iota_context *ctx, object *proc, long argc, object **args) {
+  object *list = nil;
+
+  while(argc > 0)
+    list = cons(args[--argc], list);
+  return context_run(ctx, run_call, cons(proc, list));
+}
+
+void iota_define(iota_context *ctx, const char *name, object *value) {
+  iota_context *saved = current_context;
+
+  iota_enter(ctx);
+  define_variable(make_symbol((char *) name), value, the_global_environment);
+  iota_enter(saved);
+}
+
+// NULL when name is unbound in ctx
+object *iota_lookup(iota_context *ctx, const char *name) {
+  object *var = make_symbol((char *) name);
+  binding *b;
+
+  if(is_dynamic(var))
+    return ctx->dynamic_roots[var->data.symbol.dynamic - 1];
+  b = find_binding(var, ctx->global_environment);
+  return b ? b->value : NULL;
+}
+
+void iota_define_primitive(iota_context *ctx, const char *name,
+                           iota_primitive *fn, long min_args, long max_args) {
+  iota_define(ctx, name, make_array_primitive_proc(fn, min_args, max_args));
+}
+
+void iota_raise(const char *message) {
+  error((char *) message);
+}
+
+object *iota_nil(void) {
+  return nil;
+}
+
+object *iota_true(void) {
+  return t_symbol;
+}
+
+object *iota_fixnum(long value) {
+  return make_fixnum(value);
+}
+
+// a copy: chars need not outlive the string
+object *iota_string(const char *chars, size_t length) {
+  char *copy;
+
+  if(!(copy = malloc(length + 1)))
+    return NULL;
+  memcpy(copy, chars, length);
+  copy[length] = '\0';
+  return make_string_slice(copy, length);
+}
+
+object *iota_symbol(const char *name) {
+  return make_symbol((char *) name);
+}
+
+object *iota_cons(object *car, object *cdr) {
+  return cons(car, cdr);
+}
+
+int iota_is_nil(object *obj) {
+  return is_nil(obj);
+}
+
+int iota_is_fixnum(object *obj) {
+  return is_fixnum(obj);
+}
+
+int iota_is_string(object *obj) {
+  return is_string(obj);
+}
+
+int iota_is_symbol(object *obj) {
+  return is_symbol(obj);
+}
+
+int iota_is_cons(object *obj) {
+  return is_cons(obj);
+}
+
+long iota_fixnum_value(object *obj) {
+  return is_fixnum(obj) ? obj->data.fixnum.value : 0;
+}
+
+// not NUL-terminated when it is a slice of a longer string
+const char *iota_string_value(object *obj, size_t *length) {
+  if(!is_string(obj))
+    return NULL;
+  if(length)
+    *length = obj->data.string.length;
+  return obj->data.string.value;
+}
+
+const char *iota_symbol_name(object *obj) {
+  return is_symbol(obj) ? obj->data.symbol.value : NULL;
+}
+
+object *iota_car(object *obj) {
+  return is_cons(obj) ? car(obj) : NULL;
+}
+
+object *iota_cdr(object *obj) {
+  return is_cons(obj) ? cdr(obj) : NULL;
+}
+
+char *iota_print(object *obj) {
+  object *stream, *text;
+  char *chars;
+
+  stream = make_output_string_stream();
+  write(obj, stream, the_global_environment);
+  text = output_string(stream);
+  close_stream(stream);
+  chars = malloc(text->data.string.length + 1);
+  if(chars) {
+    memcpy(chars, text->data.string.value, text->data.string.length);
+    chars[text->data.string.length] = '\0';
+  }
+  return chars;
+}
+
+/********/
+/* read */
+/********/
+
+char is_delimiter(int c) {
+  return isspace(c) || c == EOF || c == '(' || c == ')' || c == '"' || c == ';';
+}
+
+char is_initial(int c) {
+  return isalpha(c) || c == '*' || c == '/' || c == '>' ||
+    c == '<' || c == '=' || c == '?' || c == '!';
+}
+
+int peek(FILE *in) {
+  int c;
+
+  c = getc(in);
+  ungetc(c, in);
+  return c;
+}
+
+void eat_whitespace(FILE *in) {
+  int c;
+
+  while( (c = getc(in)) != EOF ) {
+    if (isspace(c))
+      continue;
+    else if (c == ';') {
+      while( (c = getc(in) != EOF) && (c != '\n') );
+      continue;
+    }
+    ungetc(c, in);
+    break;
+  }
+}
+
+object *read_pair(object *in_stream, object *env) {
+  FILE *in;
+  int c;
+
+  object *first_obj;
+  object *rest_obj;
+
+  if(in_stream == stdin_stream)
+    in_stream = lookup_variable_value(stdin_symbol, env);
+  in = in_stream->data.stream.fp;
+
+  eat_whitespace(in);
+
+  c = getc(in);
+  if(c == ')')
+    return nil;
+  if(c == EOF)
+    error("Unclosed list.");
+  ungetc(c, in);
+  
+  first_obj = read(in_stream, env);
+
+  eat_whitespace(in);
+
+  c = getc(in);
+  if (c == '.') {
+    c = peek(in);
+    if (!is_delimiter(c)) {
+      error("Dot not followed by delimiter");
+    }
+    rest_obj = read(in_stream, env);
+    eat_whitespace(in);
+    c = getc(in);
+    if (c != ')') {
+      error("Unclosed list.");
+    }
+    return cons(first_obj, rest_obj);
+  }
+  else {
+    ungetc(c, in);
+    rest_obj = read_pair(in_stream, env);
+    return cons(first_obj, rest_obj);
+  }
+}
+
+object *read(object *in_stream, object *env) {
+  FILE *in;
+  int c;
+  int i;
+  short sign = 1;
+  long num = 0;
+  char character;
+  char buffer[BUFFER_MAX];
+  char error_msg[BUFFER_MAX];
+
+  if(in_stream == stdin_stream)
+    in_stream = lookup_variable_value(stdin_symbol, env);
+  
+  in = in_stream->data.stream.fp;
+
+  eat_whitespace(in);
+
+  c = getc(in);
+
+  if(c == EOF)
+    return eof_object;
+  else if(c == '#') {
+    character = getc(in);
     if(character == '\\') {
       character = getc(in);
       switch(character) {
@@ -1099,7 +2886,7 @@ object *read_proc(object *args, object *env) {
   object *ins;
   //env = car(args);
   if( is_nil(args) ) {
-    ins = eval(make_symbol("*stdin*"), env);
+    ins = lookup_variable_value(stdin_symbol, env);
   }
   else {
     ins = car(args);
@@ -1222,7 +3009,9 @@ object *make_macro(object *params,
   obj->type = MACRO;
   obj->data.macro.parameters = params;
   obj->data.macro.body = body;
-  obj->data.macro.env = env;
+  obj->data.macro.env = capture_environment(env);
+  obj->data.macro.info = NULL;
+  describe_params(params, &obj->data.macro.params);
 
   return obj;
 }
@@ -1333,15 +3122,22 @@ object *eval_sequence(object *exps, object *env) {
   return eval(car(exps), env);
 }
 
+// evaluates left to right, appending at the tail
 object *list_of_values(object *exps, object *env) {
   assert( is_list(exps) );
-  if (is_no_operands(exps)) {
-    return nil;
-  }
-  else {
-    return cons(eval(first_operand(exps), env),
-                list_of_values(rest_operands(exps), env));
+  object *values = nil;
+  object *tail = nil;
+  object *cell;
+
+  for(; !is_no_operands(exps); exps = rest_operands(exps)) {
+    cell = cons(eval(first_operand(exps), env), nil);
+    if(is_nil(tail))
+      values = cell;
+    else
+      cdr(tail) = cell;
+    tail = cell;
   }
+  return values;
 }
 
 object *copy_list(object *list) {
@@ -1352,40 +3148,12 @@ object *copy_list(object *list) {
   iterator = list;
   new_list = nil;
   while(!is_nil(iterator)) {
-    new_list = cons(car(list), new_list);
+    new_list = cons(car(iterator), new_list);
     iterator = cdr(iterator);
   }
   return reverse(new_list);
 }
 
-object *parse_args(object *args, object *params) {
-  assert( is_list(args) );
-  assert( is_list(params) );
-  //object *args_copy = copy_list(args);
-  object *args_copy = args;
-  object *arg_iterator = args_copy;
-  object *param_iterator = params;
-  
-  // fix the args
-  if(is_nil(args_copy)) {
-    return args_copy;
-  }
-  else if( is_eq(car(params), rest_keyword) ) {
-    return cons(args_copy, nil);
-  }
-  else {
-    while(!is_nil(cdr(param_iterator))) {
-      if (is_eq(cadr(param_iterator), rest_keyword)) {
-        cdr(arg_iterator) = cons(cdr(arg_iterator), nil);
-        break;
-      }
-      arg_iterator = cdr(arg_iterator);
-      param_iterator = cdr(param_iterator);
-    }
-    return args_copy;
-  }
-}
-
 object *parse_params(object *params) {
   assert( is_list(params) );
   object *param_iterator, *cleaned_params;
@@ -1401,22 +3169,55 @@ object *parse_params(object *params) {
   return reverse(cleaned_params);
 }
 
+void describe_params(object *params, param_descriptor *d) {
+  assert( is_list(params) );
+  object *names;
+  long i;
+
+  names = parse_params(params);
+  d->count = len(names);
+  d->slots = malloc(d->count * sizeof(object *));
+  if(d->count && !d->slots)
+    error("Could not allocate parameters.");
+  for(i = 0; !is_nil(names); names = cdr(names), i++)
+    d->slots[i] = car(names);
+  d->required = 0;
+  d->rest = 0;
+  for(; !is_nil(params); params = cdr(params)) {
+    if(is_eq(car(params), rest_keyword)) {
+      d->rest = 1;
+      break;
+    }
+    d->required++;
+  }
+}
+
 object *apply(object *proc, object *args, object *env) {
   assert( is_list(args) );
   object *exp;
-  object *parsed_args;
-  object *parsed_params;
-  if (is_primitive_proc(proc))
+  object *result;
+  object **base;
+  if (is_primitive_proc(proc)) {
+    if(proc->data.primitive_proc.array_fn)
+      return apply_array_primitive(proc, args, env);
     return (proc->data.primitive_proc.fn)(args, env);
+  }
   else if (is_compound_proc(proc)) {
-    parsed_args = parse_args(args, proc->data.compound_proc.parameters);
-    parsed_params = parse_params(proc->data.compound_proc.parameters);
-    exp = proc->data.compound_proc.body;
-    return eval_sequence(exp,
-                         extend_environment(
-                           parsed_params,
-                           parsed_args,
-                           proc->data.compound_proc.env));
+    exp = optimized_body(proc);
+    if(!frame_escapes(proc)) {
+      base = eval_mark();
+      env = bind_region_frame(&proc->data.compound_proc.params, args,
+                              proc->data.compound_proc.env);
+      if(!(result = jit_run(proc, env)))
+        result = eval_sequence(exp, env);
+      eval_sp = base;
+      return result;
+    }
+    env = bind_frame(&proc->data.compound_proc.params, args,
+                     proc->data.compound_proc.env);
+    if((result = jit_run(proc, env)))
+      return result;
+    return eval_sequence(exp, env);
   }
   else {
     write(proc, stdout_stream, env);
@@ -1428,18 +3229,13 @@ object *macroexpand(object *proc, object *args) {
   assert( is_list(args) );
   object *body;
   object *expanded_body;
-  object *parsed_params;
-  object *parsed_args;
   
   if(is_macro(proc)) {
-    parsed_args = parse_args(args, proc->data.macro.parameters);
-    parsed_params = parse_params(proc->data.macro.parameters);
-    body = proc->data.macro.body;
+    body = optimized_body(proc);
     expanded_body = eval_sequence(body,
-                                  extend_environment(
-                                    parsed_params,
-                                    parsed_args,
-                                    proc->data.macro.env));
+                                  bind_frame(&proc->data.macro.params,
+                                             args,
+                                             proc->data.macro.env));
   }
   //else if(proc->data.macro.expanded) {
   //  expanded_body = body;
@@ -1523,53 +3319,92 @@ object *eval_sequence_head(object *exp, object *env) {
   return cons(head,this);
 }
       
-object *eval_backquoted(object *exp, object *env, int backquote_depth) {
-  object *thing_to_splice;
-  object *head;
-  object *this;
-  object *cdr_eval;
-  if(is_escaped(exp)) {
-    //return eval(text_of_quotation(exp), env);
-    return maybe_eval_backquoted(text_of_quotation(exp), env, --backquote_depth);
-  }
-  if(is_backquoted(exp)) {
-    return eval_backquoted(text_of_quotation(exp), env, ++backquote_depth);
-  }
-  else if(is_cons(exp)) {
-    if (is_spliced(car(exp))) {
-      thing_to_splice = text_of_quotation(car(exp));
-      //head = eval(thing_to_splice, env);
-      head = maybe_eval_backquoted(thing_to_splice, env, --backquote_depth);
-      if(is_nil(head)) {
-        //return eval_backquoted(cdr(exp), env);
-        return eval_backquoted(cdr(exp), env, backquote_depth);
-      }
-      if(!is_cons(head)) {
-        printf("%d\n",thing_to_splice->type);
-        error("Attempt to splice in non-cons.");
-      }
-      this = head;
-      while(!is_nil(cdr(this)))
-        this = cdr(this);
-      cdr_eval = eval_backquoted(cdr(exp), env, backquote_depth);
-      cdr(this) = cdr_eval;
-      return head;
-    }
-    else {
-      return cons(eval_backquoted(car(exp), env, backquote_depth),
-                  eval_backquoted(cdr(exp), env, backquote_depth));
-    }
+// a copy of the spliced list ending in the rest of the template
+object *splice_proc(object **args, long argc, object *env) {
+  object *head = nil;
+  object *tail = nil;
+  object *list, *cell;
+
+  if(is_nil(args[0]))
+    return args[1];
+  if(!is_cons(args[0]))
+    error("Attempt to splice in non-cons.");
+  for(list = args[0]; is_cons(list); list = cdr(list)) {
+    cell = cons(car(list), nil);
+    if(is_nil(tail))
+      head = cell;
+    else
+      cdr(tail) = cell;
+    tail = cell;
+  }
+  cdr(tail) = args[1];
+  return head;
+}
+
+object *quasi_call(object *constructor, object *a, object *b) {
+  return cons(make_literal(constructor), cons(a, cons(b, nil)));
+}
+
+// code that builds template at the given nesting depth; sub-trees with
+// nothing to evaluate stay quoted and are shared by every result
+object *quasiquote(object *template, int depth) {
+  object *head, *rest;
+
+  if(!is_cons(template))
+    return make_literal(template);
+  if(is_escaped(template) && depth == 1)
+    return text_of_quotation(template);
+  if(is_escaped(template) || is_backquoted(template)) {
+    // keep the tag; what it wraps is one level further out or in
+    head = make_literal(car(template));
+    rest = quasiquote(cdr(template),
+                      is_escaped(template) ? depth - 1 : depth + 1);
+  }
+  else if(is_spliced(car(template)) && depth == 1) {
+    return quasi_call(quasi_append, text_of_quotation(car(template)),
+                      quasiquote(cdr(template), depth));
   }
   else {
-    return exp;
+    if(is_spliced(car(template)))
+      head = quasi_call(quasi_cons, make_literal(comma_at_symbol),
+                        quasiquote(cdar(template), depth - 1));
+    else
+      head = quasiquote(car(template), depth);
+    rest = quasiquote(cdr(template), depth);
   }
+  if(is_literal(head) && is_literal(rest))
+    return make_literal(template);
+  return quasi_call(quasi_cons, head, rest);
 }
 
-object *maybe_eval_backquoted(object *exp, object *env, int backquote_depth) {
-  if(backquote_depth > 0)
-    return eval_backquoted(exp, env, backquote_depth);
-  else
-    return eval(exp, env);
+// (let ((var init) ...) body ...) as a bind form, which evaluates the
+// inits into a new frame without making a closure
+object *let_to_frame_binding(object *exp) {
+  object *iterator;
+
+  for(iterator = cadr(exp); is_cons(iterator); iterator = cdr(iterator))
+    if(!is_cons(car(iterator)) || !is_symbol(caar(iterator)) ||
+       !is_cons(cdar(iterator)))
+      return let_to_combination(exp);
+  return cons(bind_symbol,
+              cons(cars_of_list(cadr(exp)),
+                   cons(cadrs_of_list(cadr(exp)), cddr(exp))));
+}
+
+// cond and let as the core forms they stand for.  Nothing is kept:
+// procedure bodies are rewritten once by optimize(), and a form run
+// as data may have been changed since it was last seen.
+object *desugared(object *exp) {
+  if(is_cond(exp))
+    return cond_to_if(exp);
+  return let_to_frame_binding(exp);
+}
+
+// translated afresh each time eval meets it, since the template may
+// have been changed; optimize() keeps the translation of those in
+// procedure bodies
+object *quasiquote_code(object *exp) {
+  return quasiquote(text_of_quotation(exp), 1);
 }
 
 object *prepare_args_for_apply(object *args) {
@@ -1608,8 +3443,141 @@ object *let_to_combination(object *let_exp) {
   return cons(make_lambda(vars, body), exps);
 }
 
+char is_dynamic_let(object *exp) {
+  return is_tagged_list(exp, dynamic_let_symbol);
+}
+
+// make var a dynamic variable, its current global value becoming the
+// root
+void make_dynamic(object *var) {
+  binding *b;
+
+  pthread_mutex_lock(&runtime_lock);
+  if(!is_dynamic(var)) {
+    if(dynamic_count == DYNAMIC_MAX) {
+      pthread_mutex_unlock(&runtime_lock);
+      error("Too many dynamic variables.");
+    }
+    if((b = find_binding(var, the_global_environment)))
+      current_context->dynamic_roots[dynamic_count] = b->value;
+    var->data.symbol.dynamic = ++dynamic_count;
+  }
+  pthread_mutex_unlock(&runtime_lock);
+  note_global_binding(var);
+}
+
+// (dynamic-let ((var init) ...) body ...): the inits are evaluated
+// first, then every var is rebound for the extent of the body
+object *eval_dynamic_let(object *exp, object *env) {
+  object *bindings, *value;
+  object **base, **value_sp;
+  long depth = dynamic_depth();
+
+  base = eval_mark();
+  for(bindings = cadr(exp); !is_nil(bindings); bindings = cdr(bindings)) {
+    if(!is_symbol(caar(bindings)) || !is_dynamic(caar(bindings)))
+      error("Not a dynamic variable.");
+    eval_push(eval(cadar(bindings), env));
+  }
+  value_sp = base;
+  for(bindings = cadr(exp); !is_nil(bindings); bindings = cdr(bindings))
+    dynamic_bind(caar(bindings), *value_sp++);
+  eval_sp = base;
+  value = eval_sequence(cddr(exp), env);
+  dynamic_unwind(depth);
+  return value;
+}
+
+char is_while(object *exp) {
+  return is_tagged_list(exp, while_symbol);
+}
+
+char is_loop(object *exp) {
+  return is_tagged_list(exp, loop_symbol);
+}
+
+// a loop at top level has no procedure body to be optimized with, so
+// it is optimized here, once, rather than having the cond and let in it
+// rewritten every round
+object *eval_top_level_loop(object *exp, object *env) {
+  object *deps = nil;
+  object *result;
+
+  exp = optimize(exp, nil, env, &deps);
+  top_level_loops++;
+  result = is_while(exp) ? eval_while(exp, env) : eval_loop(exp, env);
+  top_level_loops--;
+  return result;
+}
+
+// (while test body ...): nil once test is false
+object *eval_while(object *exp, object *env) {
+  object *body;
+
+  if(env == the_global_environment && !top_level_loops)
+    return eval_top_level_loop(exp, env);
+  while(!is_nil(eval(cadr(exp), env))) {
+    consume_fuel();
+    for(body = cddr(exp); !is_nil(body); body = cdr(body))
+      eval(car(body), env);
+  }
+  return nil;
+}
+
+// (loop ((var init step) ...) (test result ...) body ...): one frame
+// holds the vars for the whole loop.  Each round runs the body, then
+// evaluates every step before assigning any.  Once test holds the
+// results are evaluated, or the loop gives nil when there are none.
+object *eval_loop(object *exp, object *env) {
+  object *specs, *clause, *body, *frame;
+  object **base, **value_sp;
+  binding *bindings;
+  long i;
+
+  if(env == the_global_environment && !top_level_loops)
+    return eval_top_level_loop(exp, env);
+  if(!is_cons(cdr(exp)) || !is_cons(cddr(exp)) || !is_cons(caddr(exp)) ||
+     !is_proper_list(cadr(exp)))
+    error("Malformed loop.");
+  clause = caddr(exp);
+  frame = make_frame(env, len(cadr(exp)));
+  for(specs = cadr(exp); !is_nil(specs); specs = cdr(specs))
+    if(!is_cons(car(specs)) || !is_symbol(caar(specs)) ||
+       !is_cons(cdar(specs)))
+      error("Malformed loop.");
+  for(specs = cadr(exp); !is_nil(specs); specs = cdr(specs))
+    add_binding_to_frame(caar(specs), eval(cadar(specs), env), frame);
+  bindings = frame->data.frame.bindings;
+  while(is_nil(eval(car(clause), frame))) {
+    consume_fuel();
+    for(body = cdddr(exp); !is_nil(body); body = cdr(body))
+      eval(car(body), frame);
+    base = eval_mark();
+    for(specs = cadr(exp); !is_nil(specs); specs = cdr(specs))
+      if(!is_nil(cddar(specs)))
+        eval_push(eval(car(cddar(specs)), frame));
+    value_sp = base;
+    for(specs = cadr(exp), i = 0; !is_nil(specs); specs = cdr(specs), i++)
+      if(!is_nil(cddar(specs)))
+        bindings[i].value = *value_sp++;
+    eval_sp = base;
+  }
+  if(is_nil(cdr(clause)))
+    return nil;
+  return eval_sequence(cdr(clause), frame);
+}
+
+object *make_dynamic_proc(object *args, object *env) {
+  if(!is_symbol(car(args)))
+    error("Not a symbol.");
+  make_dynamic(car(args));
+  return car(args);
+}
+
 object *eval(object *exp, object *env) {
-  object *proc, *args;
+  object *proc, *args, *value;
+  object **base;
+  long argc;
   while(1) {
     if(is_self_evaluating(exp)) {
       return exp;
@@ -1621,7 +3589,7 @@ object *eval(object *exp, object *env) {
       return text_of_quotation(exp);
     }
     else if (is_backquoted(exp)) {
-      return eval_backquoted(text_of_quotation(exp), env, 1);
+      exp = quasiquote_code(exp);
     }
     else if (is_piped(exp)) {
       exp = eval(text_of_quotation(exp), env);
@@ -1633,17 +3601,36 @@ object *eval(object *exp, object *env) {
       return eval_definition(exp,env);
     }
     else if (is_if(exp)) {
+      consume_fuel();
       exp = !is_nil(eval(if_predicate(exp), env)) ? if_consequent(exp) : if_alternative(exp);
     }
-    else if (is_cond(exp)) {
-      exp = cond_to_if(exp);
-    }
-    else if (is_let(exp)) {
-      exp = let_to_combination(exp);
+    else if (is_cond(exp) || is_let(exp)) {
+      exp = desugared(exp);
     }
     else if (is_begin(exp)) {
       return eval_sequence(begin_actions(exp), env);
     }
+    else if (is_frame_binding(exp)) {
+      return eval_frame_binding(exp, env);
+    }
+    else if (is_dynamic_let(exp)) {
+      return eval_dynamic_let(exp, env);
+    }
+    else if (is_while(exp)) {
+      return eval_while(exp, env);
+    }
+    else if (is_loop(exp)) {
+      return eval_loop(exp, env);
+    }
+    else if (is_inline_guard(exp)) {
+      exp = inline_guard_choice(exp);
+    }
+    else if (is_future_form(exp)) {
+      return make_future(cadr(exp), env);
+    }
+    else if (is_delay(exp)) {
+      return make_promise(cadr(exp), env);
+    }
     else if (is_lambda(exp)) {
       return make_compound_proc(lambda_parameters(exp),
                                 lambda_body(exp),
@@ -1655,6 +3642,7 @@ object *eval(object *exp, object *env) {
                         env);
     }
     else if (is_application(exp)) {
+      consume_fuel();
       proc = eval(operator(exp), env);
       args = operands(exp);
       if(is_primitive_proc(proc) && proc->data.primitive_proc.fn == eval_proc) {
@@ -1669,6 +3657,18 @@ object *eval(object *exp, object *env) {
       if(is_macro(proc)) {
         return apply_macro(proc, args, env);
       }
+      else if(is_primitive_proc(proc) && proc->data.primitive_proc.array_fn) {
+        // operands go straight onto the evaluator stack, no arg list
+        base = eval_mark();
+        for(argc = 0; !is_no_operands(args); args = rest_operands(args)) {
+          value = eval(first_operand(args), env);
+          eval_push(value);
+          argc++;
+        }
+        value = call_array_primitive(proc, base, argc, env);
+        eval_sp = base;
+        return value;
+      }
       else {
         args = list_of_values(args, env);
         //if(is_primitive_proc(proc) &&
@@ -1686,16 +3686,2080 @@ object *eval(object *exp, object *env) {
   exit(1);
 }
 
-/*********/
-/* print */
-/*********/
+/*******/
+/* jit */
+/*******/
 
-void write_pair(object *cons, object *out_stream, object *env) {
-  FILE *out;
+// Compound procedures called JIT_THRESHOLD times through apply() get
+// their optimized body translated to x86-64 by stitching together
+// fixed code templates.  Compiled code takes the procedure's extended
+// environment, keeps it in rbx, and calls back into the interpreter
+// (eval, apply, lookup_variable_value) for whatever it has no template
+// for.  It returns NULL when the bindings it inlined have changed, and
+// apply() then falls back to eval_sequence.
+typedef struct proc_info {
+  object *body;
+  _Atomic long calls;
+  object *(*_Atomic code)(object *env);
+  long code_size;
+  char jit_failed;
+  char escapes_analyzed;
+  char frame_escapes;
+  object *optimized;            // body after optimize(), NULL until first call
+  object *deps;                 // ((symbol . version) ...) it was made under
+  long optimized_epoch;
+  struct proc_info *next;
+} proc_info;
+
+typedef struct jit_buffer {
+  unsigned char *code;
+  long size;
+  long capacity;
+  param_descriptor *params;
+  object *env;
+  object *locals;               // names bound by enclosing bind forms
+  long frames;                  // how many of those frames rbx is below
+  char failed;
+} jit_buffer;
+
+pthread_mutex_t jit_lock = PTHREAD_MUTEX_INITIALIZER;
+proc_info *proc_infos[PROC_INFO_BUCKETS];
+long jit_threshold = JIT_THRESHOLD;
+_Atomic long jit_epoch = 0;
+long jit_procedures = 0;
+long jit_bytes = 0;
+unsigned char *jit_arena = NULL;
+long jit_arena_left = 0;
+
+// names the templates inline; rebinding any of them anywhere
+// invalidates compiled code
+char *jit_inlined_names[] = {"+", "-", "<", ">", "=", "car", "cdr", NULL};
+object *jit_inlined[8];
+
+void jit_init() {
+  char *threshold;
+  int i;
+
+  for(i = 0; jit_inlined_names[i]; i++)
+    jit_inlined[i] = make_symbol(jit_inlined_names[i]);
+  jit_inlined[i] = NULL;
+  threshold = getenv("IOTA_JIT_THRESHOLD");
+  if(threshold)
+    jit_threshold = atol(threshold);
+}
+
+void jit_note_binding(object *var) {
+  int i;
+
+  for(i = 0; jit_inlined[i]; i++)
+    if(var == jit_inlined[i]) {
+      atomic_fetch_add(&jit_epoch, 1);
+      return;
+    }
+}
+
+proc_info *find_proc_info(object *body) {
+  proc_info *info;
+  unsigned long bucket;
+
+  bucket = ((unsigned long) body >> 4) % PROC_INFO_BUCKETS;
+  pthread_mutex_lock(&jit_lock);
+  for(info = proc_infos[bucket]; info; info = info->next)
+    if(info->body == body)
+      break;
+  if(!info) {
+    info = calloc(1, sizeof(proc_info));
+    if(!info) {
+      pthread_mutex_unlock(&jit_lock);
+      error("Could not allocate procedure info.");
+    }
+    info->body = body;
+    info->next = proc_infos[bucket];
+    proc_infos[bucket] = info;
+  }
+  pthread_mutex_unlock(&jit_lock);
+  return info;
+}
+
+#if defined(__x86_64__)
+
+void jit_bytes_out(jit_buffer *b, const void *bytes, long n) {
+  if(b->size + n > b->capacity) {
+    b->capacity = (b->capacity + n) * 2;
+    b->code = realloc(b->code, b->capacity);
+    if(!b->code)
+      error("Could not grow jit buffer.");
+  }
+  memcpy(b->code + b->size, bytes, n);
+  b->size += n;
+}
+
+#define jit_emit(B, ...) do {                             \
+    unsigned char bytes_[] = {__VA_ARGS__};               \
+    jit_bytes_out(B, bytes_, sizeof(bytes_));             \
+  } while(0)
+
+void jit_imm64(jit_buffer *b, const void *value) {
+  jit_bytes_out(b, &value, 8);
+}
+
+// mov rax/rdi/rsi/rcx, imm64
+void jit_mov_rax(jit_buffer *b, const void *value) { jit_emit(b, 0x48, 0xb8); jit_imm64(b, value); }
+void jit_mov_rdi(jit_buffer *b, const void *value) { jit_emit(b, 0x48, 0xbf); jit_imm64(b, value); }
+void jit_mov_rsi(jit_buffer *b, const void *value) { jit_emit(b, 0x48, 0xbe); jit_imm64(b, value); }
+void jit_mov_rcx(jit_buffer *b, const void *value) { jit_emit(b, 0x48, 0xb9); jit_imm64(b, value); }
+
+// calls need rsp 16-byte aligned; depth counts our pushes since the
+// (aligned) prologue
+void jit_call(jit_buffer *b, const void *fn, int depth) {
+  if(depth & 1)
+    jit_emit(b, 0x48, 0x83, 0xec, 0x08);        // sub rsp, 8
+  jit_emit(b, 0x49, 0xbb);                      // mov r11, fn
+  jit_imm64(b, fn);
+  jit_emit(b, 0x41, 0xff, 0xd3);                // call r11
+  if(depth & 1)
+    jit_emit(b, 0x48, 0x83, 0xc4, 0x08);        // add rsp, 8
+}
+
+// jcc/jmp rel32 with the displacement patched later
+long jit_jump(jit_buffer *b, unsigned char opcode) {
+  if(opcode == 0xe9)
+    jit_emit(b, 0xe9, 0, 0, 0, 0);
+  else
+    jit_emit(b, 0x0f, opcode, 0, 0, 0, 0);
+  return b->size;
+}
+
+void jit_patch(jit_buffer *b, long from) {
+  int rel = b->size - from;
+  memcpy(b->code + from - 4, &rel, 4);
+}
+
+// jump back to an earlier offset
+void jit_jump_back(jit_buffer *b, long to) {
+  int rel;
+
+  jit_emit(b, 0xe9, 0, 0, 0, 0);
+  rel = to - b->size;
+  memcpy(b->code + b->size - 4, &rel, 4);
+}
+
+#define JIT_JE 0x84
+#define JIT_JNE 0x85
+#define JIT_JMP 0xe9
+
+void jit_expression(jit_buffer *b, object *exp, int depth);
+
+long jit_param_index(jit_buffer *b, object *var) {
+  long i;
+
+  for(i = 0; i < b->params->count; i++)
+    if(b->params->slots[i] == var)
+      return i;
+  return -1;
+}
+
+// true when var resolves to the global frame from the procedure's
+// defining environment
+char jit_is_global(jit_buffer *b, object *var) {
+  object *env;
+  long i;
+
+  if(is_member(var, b->locals))
+    return 0;
+  for(env = b->env; !is_nil(enclosing_environment(env));
+      env = enclosing_environment(env))
+    for(i = 0; i < env->data.frame.count; i++)
+      if(env->data.frame.bindings[i].name == var)
+        return 0;
+  return 1;
+}
+
+void jit_fallback(jit_buffer *b, object *exp, int depth) {
+  jit_mov_rdi(b, exp);
+  jit_emit(b, 0x48, 0x89, 0xde);                // mov rsi, rbx
+  jit_call(b, eval, depth);
+}
+
+void jit_sequence(jit_buffer *b, object *exps, int depth) {
+  if(is_nil(exps))
+    jit_mov_rax(b, nil);
+  for(; !is_nil(exps); exps = cdr(exps))
+    jit_expression(b, car(exps), depth);
+}
+
+char jit_is_plain_proc(object *proc) {
+  return is_compound_proc(proc) ||
+    (is_primitive_proc(proc) &&
+     proc->data.primitive_proc.fn != eval_proc &&
+     proc->data.primitive_proc.fn != apply_proc);
+}
+
+object *jit_binary_proc(object *proc, object *a, object *b, object *env) {
+  object *args[2] = {a, b};
+
+  return call_array_primitive(proc, args, 2, env);
+}
+
+void jit_entry() {
+  consume_fuel();
+}
+
+object *jit_make_frame(object *vars, object *env) {
+  return make_frame(env, len(vars));
+}
+
+// (bind (var ...) (init ...) body ...): the inits run in the current
+// frame and the body in a new one, which rbx points to until the body
+// is done.  Below it the parameters are no longer rbx's slots, so they
+// are looked up like any other variable.
+void jit_frame_binding(jit_buffer *b, object *exp, int depth) {
+  object *vars, *inits, *locals = b->locals;
+
+  jit_mov_rdi(b, cadr(exp));
+  jit_emit(b, 0x48, 0x89, 0xde);                // mov rsi, rbx
+  jit_call(b, jit_make_frame, depth);
+  jit_emit(b, 0x50);                            // push rax
+  for(vars = cadr(exp), inits = caddr(exp); !is_nil(vars);
+      vars = cdr(vars), inits = cdr(inits)) {
+    jit_expression(b, car(inits), depth + 1);
+    jit_emit(b, 0x48, 0x89, 0xc6);              // mov rsi, rax
+    jit_mov_rdi(b, car(vars));
+    jit_emit(b, 0x48, 0x8b, 0x14, 0x24);        // mov rdx, [rsp]
+    jit_call(b, add_binding_to_frame, depth + 1);
+  }
+  jit_emit(b, 0x48, 0x87, 0x1c, 0x24);          // xchg rbx, [rsp]
+  for(vars = cadr(exp); !is_nil(vars); vars = cdr(vars))
+    b->locals = cons(car(vars), b->locals);
+  b->frames++;
+  jit_sequence(b, cdddr(exp), depth + 1);
+  b->frames--;
+  b->locals = locals;
+  jit_emit(b, 0x5b);                            // pop rbx
+}
+
+void jit_application(jit_buffer *b, object *exp, int depth) {
+  object *args, *op;
+  long argc, i, slow, done;
+
+  op = car(exp);
+  argc = len(cdr(exp));
+  jit_expression(b, op, depth);
+  jit_emit(b, 0x50);                            // push rax
+  jit_emit(b, 0x48, 0x89, 0xc7);                // mov rdi, rax
+  jit_call(b, jit_is_plain_proc, depth + 1);
+  jit_emit(b, 0x84, 0xc0);                      // test al, al
+  slow = jit_jump(b, JIT_JE);
+  for(args = cdr(exp), i = 0; !is_nil(args); args = cdr(args), i++) {
+    jit_expression(b, car(args), depth + 1 + i);
+    jit_emit(b, 0x50);                          // push rax
+  }
+  jit_mov_rax(b, nil);
+  for(i = argc; i > 0; i--) {
+    jit_emit(b, 0x48, 0x89, 0xc6);              // mov rsi, rax
+    jit_emit(b, 0x5f);                          // pop rdi
+    jit_call(b, cons, depth + i);
+  }
+  jit_emit(b, 0x5f);                            // pop rdi
+  jit_emit(b, 0x48, 0x89, 0xc6);                // mov rsi, rax
+  jit_emit(b, 0x48, 0x89, 0xda);                // mov rdx, rbx
+  jit_call(b, apply, depth);
+  done = jit_jump(b, JIT_JMP);
+  // eval, apply and macros need the unevaluated form
+  jit_patch(b, slow);
+  jit_emit(b, 0x58);                            // pop rax
+  jit_fallback(b, exp, depth);
+  jit_patch(b, done);
+}
+
+// + - < > = on two fixnums, car and cdr
+char jit_inline_primitive(jit_buffer *b, object *exp, int depth) {
+  object *op, *proc;
+  long argc, slow, slow_too, done;
+  int i;
+  unsigned char cmov = 0;
+
+  op = car(exp);
+  argc = len(cdr(exp));
+  for(i = 0; jit_inlined[i]; i++)
+    if(op == jit_inlined[i])
+      break;
+  if(!jit_inlined[i] || jit_param_index(b, op) >= 0 || !jit_is_global(b, op))
+    return 0;
+  proc = lookup_variable_value(op, the_global_environment);
+  if(!is_primitive_proc(proc))
+    return 0;
+
+  if(proc->data.primitive_proc.array_fn == car_proc ||
+     proc->data.primitive_proc.array_fn == cdr_proc) {
+    if(argc != 1)
+      return 0;
+    jit_expression(b, cadr(exp), depth);
+    if(proc->data.primitive_proc.array_fn == car_proc)
+      jit_emit(b, 0x48, 0x8b, 0x40, offsetof(object, data.cons.first));
+    else
+      jit_emit(b, 0x48, 0x8b, 0x40, offsetof(object, data.cons.rest));
+    return 1;
+  }
+
+  if(argc != 2)
+    return 0;
+  if(proc->data.primitive_proc.array_fn == is_less_than_proc)
+    cmov = 0x4c;
+  else if(proc->data.primitive_proc.array_fn == is_greater_than_proc)
+    cmov = 0x4f;
+  else if(proc->data.primitive_proc.array_fn == is_equal_proc)
+    cmov = 0x44;
+  else if(proc->data.primitive_proc.array_fn != add_proc &&
+          proc->data.primitive_proc.array_fn != subtract_proc)
+    return 0;
+
+  jit_expression(b, cadr(exp), depth);
+  jit_emit(b, 0x50);                            // push rax
+  jit_expression(b, caddr(exp), depth + 1);
+  jit_emit(b, 0x48, 0x89, 0xc6);                // mov rsi, rax
+  jit_emit(b, 0x5f);                            // pop rdi
+  jit_emit(b, 0x83, 0x3f, FIXNUM);              // cmp dword [rdi], FIXNUM
+  slow = jit_jump(b, JIT_JNE);
+  jit_emit(b, 0x83, 0x3e, FIXNUM);              // cmp dword [rsi], FIXNUM
+  slow_too = jit_jump(b, JIT_JNE);
+  jit_emit(b, 0x48, 0x8b, 0x47, offsetof(object, data.fixnum.value)); // mov rax, [rdi+v]
+  if(cmov) {
+    jit_emit(b, 0x48, 0x3b, 0x46, offsetof(object, data.fixnum.value)); // cmp rax, [rsi+v]
+    jit_mov_rax(b, nil);
+    jit_mov_rcx(b, t_symbol);
+    jit_emit(b, 0x48, 0x0f, cmov, 0xc1);        // cmovcc rax, rcx
+  }
+  else {
+    if(proc->data.primitive_proc.array_fn == add_proc)
+      jit_emit(b, 0x48, 0x03, 0x46, offsetof(object, data.fixnum.value)); // add rax, [rsi+v]
+    else
+      jit_emit(b, 0x48, 0x2b, 0x46, offsetof(object, data.fixnum.value)); // sub rax, [rsi+v]
+    jit_emit(b, 0x48, 0x89, 0xc7);              // mov rdi, rax
+    jit_call(b, make_fixnum, depth);
+  }
+  done = jit_jump(b, JIT_JMP);
+  jit_patch(b, slow);
+  jit_patch(b, slow_too);
+  jit_emit(b, 0x48, 0x89, 0xf2);                // mov rdx, rsi
+  jit_emit(b, 0x48, 0x89, 0xfe);                // mov rsi, rdi
+  jit_mov_rdi(b, proc);
+  jit_emit(b, 0x48, 0x89, 0xd9);                // mov rcx, rbx
+  jit_call(b, jit_binary_proc, depth);
+  jit_patch(b, done);
+  return 1;
+}
+
+// (guard name version inlined call): the version test of
+// inline_guard_choice, made by the compiled code on each run
+void jit_inline_guard(jit_buffer *b, object *exp, int depth) {
+  object *rest = cdr(exp);
+  long call_jump, end_jump;
+  int disp = offsetof(object, data.symbol.version);
+
+  jit_mov_rax(b, car(rest));
+  jit_emit(b, 0x48, 0x8b, 0x80);                // mov rax, [rax+disp32]
+  jit_bytes_out(b, &disp, 4);
+  jit_mov_rcx(b, (void *) cadr(rest)->data.fixnum.value);
+  jit_emit(b, 0x48, 0x39, 0xc8);                // cmp rax, rcx
+  call_jump = jit_jump(b, JIT_JNE);
+  jit_expression(b, caddr(rest), depth);
+  end_jump = jit_jump(b, JIT_JMP);
+  jit_patch(b, call_jump);
+  jit_expression(b, car(cdddr(rest)), depth);
+  jit_patch(b, end_jump);
+}
+
+void jit_expression(jit_buffer *b, object *exp, int depth) {
+  long i, else_jump, end_jump, top;
+  object *body;
+  binding *bound;
+  int disp;
+
+  if(is_self_evaluating(exp)) {
+    jit_mov_rax(b, exp);
+  }
+  else if(is_symbol(exp)) {
+    if(!b->frames && (i = jit_param_index(b, exp)) >= 0) {
+      // the i-th slot of the procedure's frame
+      disp = i * sizeof(binding) + offsetof(binding, value);
+      jit_emit(b, 0x48, 0x8b, 0x43, offsetof(object, data.frame.bindings)); // mov rax, [rbx+b]
+      jit_emit(b, 0x48, 0x8b, 0x80);            // mov rax, [rax+disp32]
+      jit_bytes_out(b, &disp, 4);
+    }
+    else {
+      jit_mov_rdi(b, exp);
+      jit_emit(b, 0x48, 0x89, 0xde);            // mov rsi, rbx
+      jit_call(b, lookup_variable_value, depth);
+    }
+  }
+  else if(is_quoted(exp)) {
+    jit_mov_rax(b, text_of_quotation(exp));
+  }
+  else if(is_if(exp)) {
+    jit_expression(b, if_predicate(exp), depth);
+    jit_emit(b, 0x83, 0x38, NIL);               // cmp dword [rax], NIL
+    else_jump = jit_jump(b, JIT_JE);
+    jit_expression(b, if_consequent(exp), depth);
+    end_jump = jit_jump(b, JIT_JMP);
+    jit_patch(b, else_jump);
+    if(is_nil(cdddr(exp)))
+      jit_mov_rax(b, nil);
+    else
+      jit_expression(b, if_alternative(exp), depth);
+    jit_patch(b, end_jump);
+  }
+  else if(is_cond(exp)) {
+    jit_expression(b, desugared(exp), depth);
+  }
+  else if(is_backquoted(exp)) {
+    jit_expression(b, quasiquote_code(exp), depth);
+  }
+  else if(is_begin(exp)) {
+    jit_sequence(b, begin_actions(exp), depth);
+  }
+  else if(is_assignment(exp)) {
+    jit_expression(b, assignment_value(exp), depth);
+    jit_emit(b, 0x48, 0x89, 0xc6);              // mov rsi, rax
+    jit_mov_rdi(b, assignment_variable(exp));
+    jit_emit(b, 0x48, 0x89, 0xda);              // mov rdx, rbx
+    jit_call(b, set_variable_value, depth);
+    jit_mov_rax(b, assignment_variable(exp));
+  }
+  else if(is_definition(exp)) {
+    // would add bindings in front of the parameters
+    b->failed = 1;
+  }
+  else if(is_while(exp)) {
+    top = b->size;
+    jit_expression(b, cadr(exp), depth);
+    jit_emit(b, 0x83, 0x38, NIL);               // cmp dword [rax], NIL
+    end_jump = jit_jump(b, JIT_JE);
+    jit_call(b, jit_entry, depth);
+    for(body = cddr(exp); !is_nil(body); body = cdr(body))
+      jit_expression(b, car(body), depth);
+    jit_jump_back(b, top);
+    jit_patch(b, end_jump);
+    jit_mov_rax(b, nil);
+  }
+  else if(is_let(exp)) {
+    jit_fallback(b, desugared(exp), depth);
+  }
+  else if(is_frame_binding(exp)) {
+    jit_frame_binding(b, exp, depth);
+  }
+  else if(is_inline_guard(exp)) {
+    jit_inline_guard(b, exp, depth);
+  }
+  else if(is_piped(exp) ||
+          is_lambda(exp) || is_macro_def(exp) || is_future_form(exp) ||
+          is_delay(exp) || is_dynamic_let(exp) || is_loop(exp)) {
+    jit_fallback(b, exp, depth);
+  }
+  else if(is_application(exp)) {
+    // an operator not bound yet is compiled as a call; it may be
+    // defined by the time the call runs
+    if(is_symbol(car(exp)) && jit_param_index(b, car(exp)) < 0 &&
+       !is_member(car(exp), b->locals) &&
+       (bound = find_binding(car(exp), b->env)) && is_macro(bound->value))
+      jit_fallback(b, exp, depth);
+    else if(!jit_inline_primitive(b, exp, depth))
+      jit_application(b, exp, depth);
+  }
+  else {
+    b->failed = 1;
+  }
+}
+
+// true if exp could define into the procedure's own frame
+char jit_defines(object *exp) {
+  if(!is_cons(exp) || is_quoted(exp))
+    return 0;
+  if(is_definition(exp))
+    return 1;
+  for(; is_cons(exp); exp = cdr(exp))
+    if(jit_defines(car(exp)))
+      return 1;
+  return 0;
+}
+
+void *jit_install(jit_buffer *b) {
+  unsigned char *code;
+  long size;
+
+  size = (b->size + 15) & ~15L;
+  if(size > jit_arena_left) {
+    jit_arena_left = size > JIT_ARENA_SIZE ? size : JIT_ARENA_SIZE;
+    jit_arena = mmap(NULL, jit_arena_left, PROT_READ | PROT_WRITE | PROT_EXEC,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(jit_arena == MAP_FAILED) {
+      jit_arena_left = 0;
+      return NULL;
+    }
+  }
+  code = jit_arena;
+  memcpy(code, b->code, b->size);
+  jit_arena += size;
+  jit_arena_left -= size;
+  jit_procedures++;
+  jit_bytes += b->size;
+  return code;
+}
+
+// compiles the optimized body, so folded and inlined code is what runs
+void jit_compile(proc_info *info, object *proc) {
+  jit_buffer b = {NULL, 0, 0, NULL, NULL, nil, 0, 0};
+  object *body = optimized_body(proc);
+  long bail, epoch;
+  void *code = NULL;
+
+  if(jit_defines(body)) {
+    info->jit_failed = 1;
+    return;
+  }
+  b.params = &proc->data.compound_proc.params;
+  b.env = proc->data.compound_proc.env;
+  epoch = atomic_load(&jit_epoch);
+
+  jit_emit(&b, 0x55);                           // push rbp
+  jit_emit(&b, 0x48, 0x89, 0xe5);               // mov rbp, rsp
+  jit_emit(&b, 0x53);                           // push rbx
+  jit_emit(&b, 0x41, 0x54);                     // push r12
+  jit_emit(&b, 0x48, 0x89, 0xfb);               // mov rbx, rdi
+  jit_mov_rax(&b, &jit_epoch);
+  jit_emit(&b, 0x48, 0x8b, 0x00);               // mov rax, [rax]
+  jit_mov_rcx(&b, (void *) epoch);
+  jit_emit(&b, 0x48, 0x39, 0xc8);               // cmp rax, rcx
+  bail = jit_jump(&b, JIT_JNE);
+  jit_call(&b, jit_entry, 0);
+  jit_sequence(&b, body, 0);
+  jit_emit(&b, 0x41, 0x5c, 0x5b, 0x5d, 0xc3);   // pop r12; pop rbx; pop rbp; ret
+  jit_patch(&b, bail);
+  jit_emit(&b, 0x31, 0xc0);                     // xor eax, eax
+  jit_emit(&b, 0x41, 0x5c, 0x5b, 0x5d, 0xc3);
+
+  pthread_mutex_lock(&jit_lock);
+  if(!b.failed && !info->code && info->optimized == body)
+    code = jit_install(&b);
+  if(code) {
+    info->code_size = b.size;
+    atomic_store(&info->code, code);
+  }
+  else if(!info->code)
+    info->jit_failed = 1;
+  pthread_mutex_unlock(&jit_lock);
+  free(b.code);
+}
+
+#else
+
+void jit_compile(proc_info *info, object *proc) {
+  info->jit_failed = 1;
+}
+
+#endif
+
+// Runs proc's body on env through compiled code, compiling it once it
+// is hot.  Returns NULL when the interpreter should run it instead.
+proc_info *proc_info_of(object *proc) {
+  proc_info **info = is_macro(proc) ?
+    &proc->data.macro.info : &proc->data.compound_proc.info;
+
+  if(!*info)
+    *info = find_proc_info(is_macro(proc) ?
+                           proc->data.macro.body :
+                           proc->data.compound_proc.body);
+  return *info;
+}
+
+object *jit_run(object *proc, object *env) {
+  proc_info *info;
+  object *(*code)(object *env);
+  object *result;
+
+  info = proc_info_of(proc);
+  code = atomic_load(&info->code);
+  if(!code) {
+    if(info->jit_failed || jit_threshold <= 0 ||
+       atomic_fetch_add(&info->calls, 1) + 1 < jit_threshold)
+      return NULL;
+    jit_compile(info, proc);
+    if(!(code = atomic_load(&info->code)))
+      return NULL;
+  }
+  result = code(env);
+  if(!result) {
+    // an inlined primitive was rebound: start counting again
+    atomic_store(&info->code, NULL);
+    atomic_store(&info->calls, 0);
+  }
+  return result;
+}
+
+// true when evaluating exp might keep hold of its environment: forms
+// that make closures or futures, define (which grows the frame), eval,
+// and calls to whatever is a macro right now, since its expansion is
+// unknown.  A miss is still safe, capture_environment moves the frame
+// off the stack, but then it is allocated twice.
+char may_capture(object *exp) {
+  object *op;
+  binding *global;
+
+  if(exp->type != CONS || is_quoted(exp))
+    return 0;
+  if(is_lambda(exp) || is_macro_def(exp) || is_definition(exp) ||
+     is_let(exp) || is_future_form(exp) || is_delay(exp) || is_piped(exp))
+    return 1;
+  op = car(exp);
+  if(is_symbol(op) && (global = find_binding(op, the_global_environment))) {
+    if(is_macro(global->value) ||
+       (is_primitive_proc(global->value) &&
+        global->value->data.primitive_proc.fn == eval_proc))
+      return 1;
+  }
+  for(; exp->type == CONS; exp = cdr(exp))
+    if(may_capture(car(exp)))
+      return 1;
+  return 0;
+}
+
+// frames of procedures whose bodies cannot capture them go on the
+// evaluator stack; the answer is worked out once per body
+char frame_escapes(object *proc) {
+  proc_info *info = proc_info_of(proc);
+
+  if(!info->escapes_analyzed) {
+    info->frame_escapes = may_capture(optimized_body(proc));
+    info->escapes_analyzed = 1;
+  }
+  return info->frame_escapes;
+}
+
+object *jit_stats_proc(object *args, object *env) {
+  return cons(make_keyword(":procedures"),
+              cons(make_fixnum(jit_procedures),
+                   cons(make_keyword(":bytes"),
+                        cons(make_fixnum(jit_bytes), nil))));
+}
+
+/************/
+/* optimize */
+/************/
+
+// Procedure bodies are rewritten once, on their first call: primitive
+// calls on literals are folded, if branches with a literal predicate
+// are pruned, cond becomes if, backquote templates become the calls
+// that build them, and let or ((lambda ...) ...) becomes a bind form
+// that evaluates its inits into a fresh frame without making a
+// closure.  Whatever global bindings a rewrite relied on are kept as
+// (symbol . version) dependencies; rebinding one of them bumps
+// binding_epoch and the body is redone on its next call.
+_Atomic long binding_epoch = 1;
+
+// called after the binding is stored: a reader that sees the new
+// version through symbol_version() also sees the new value
+void note_global_binding(object *var) {
+  __atomic_fetch_add(&var->data.symbol.version, 1, __ATOMIC_RELEASE);
+  if(var->data.symbol.watched)
+    atomic_fetch_add(&binding_epoch, 1);
+}
+
+long symbol_version(object *var) {
+  return __atomic_load_n(&var->data.symbol.version, __ATOMIC_ACQUIRE);
+}
+
+char is_frame_binding(object *exp) {
+  return is_tagged_list(exp, bind_symbol);
+}
+
+// (bind (var ...) (init ...) body ...)
+object *eval_frame_binding(object *exp, object *env) {
+  object *vars = cadr(exp);
+  object *inits = caddr(exp);
+  object *frame = make_frame(env, len(vars));
+
+  for(; !is_nil(vars); vars = cdr(vars), inits = cdr(inits))
+    add_binding_to_frame(car(vars), eval(car(inits), env), frame);
+  return eval_sequence(cdddr(exp), frame);
+}
+
+// (guard name version inlined call): the inlined body stands for the
+// call as long as name's global binding is the one it was copied from
+char is_inline_guard(object *exp) {
+  return is_tagged_list(exp, guard_symbol);
+}
+
+object *inline_guard_choice(object *exp) {
+  object *rest = cdr(exp);
+
+  if(symbol_version(car(rest)) == cadr(rest)->data.fixnum.value)
+    return caddr(rest);
+  return car(cdddr(rest));
+}
+
+char is_member(object *obj, object *list) {
+  for(; is_cons(list); list = cdr(list))
+    if(car(list) == obj)
+      return 1;
+  return 0;
+}
+
+binding *frame_binding(object *var, object *frame) {
+  long i;
+
+  for(i = frame->data.frame.count - 1; i >= 0; i--)
+    if(frame->data.frame.bindings[i].name == var)
+      return &frame->data.frame.bindings[i];
+  return NULL;
+}
+
+// the global value of var as seen from the body being optimized, or
+// NULL when it is shadowed or unbound; a global it returns is recorded
+// as a dependency, with the version read before the value
+object *global_value(object *var, object *scope, object *proc_env,
+                     object **deps) {
+  object *env, *dep;
+  binding *b;
+  long version;
+
+  if(is_member(var, scope))
+    return NULL;
+  for(env = proc_env; !is_nil(env) && env != the_global_environment;
+      env = enclosing_environment(env))
+    if(frame_binding(var, env))
+      return NULL;
+  if(is_dynamic(var) || !(b = frame_binding(var, the_global_environment)))
+    return NULL;
+  for(dep = *deps; !is_nil(dep); dep = cdr(dep))
+    if(caar(dep) == var)
+      return b->value;
+  var->data.symbol.watched = 1;
+  version = symbol_version(var);
+  *deps = cons(cons(var, make_fixnum(version)), *deps);
+  return b->value;
+}
+
+char deps_current(object *deps) {
+  for(; !is_nil(deps); deps = cdr(deps))
+    if(symbol_version(caar(deps)) != cdar(deps)->data.fixnum.value)
+      return 0;
+  return 1;
+}
+
+// the version var was recorded at, which is no newer than the value
+// global_value returned for it
+long dep_version(object *var, object *deps) {
+  for(; !is_nil(deps); deps = cdr(deps))
+    if(caar(deps) == var)
+      return cdar(deps)->data.fixnum.value;
+  return -1;
+}
+
+char is_literal(object *exp) {
+  return is_self_evaluating(exp) || is_quoted(exp);
+}
+
+object *literal_value(object *exp) {
+  return is_quoted(exp) ? text_of_quotation(exp) : exp;
+}
+
+object *make_literal(object *value) {
+  if(is_self_evaluating(value))
+    return value;
+  return cons(quote_symbol, cons(value, nil));
+}
+
+char is_proper_list(object *obj) {
+  for(; is_cons(obj); obj = cdr(obj))
+    ;
+  return is_nil(obj);
+}
+
+// (op literal ...) computed now, for pure primitives whose arguments
+// are of the types they check for; NULL when it cannot be folded
+object *fold(object *proc, object *args) {
+  object *argv[FOLD_ARGS_MAX];
+  object *(*fn)(object **args, long argc, object *env);
+  long argc, i;
+
+  fn = proc->data.primitive_proc.array_fn;
+  if(!fn)
+    return NULL;
+  for(argc = 0; !is_nil(args); args = cdr(args)) {
+    if(argc == FOLD_ARGS_MAX || !is_literal(car(args)))
+      return NULL;
+    argv[argc++] = literal_value(car(args));
+  }
+  if(argc < proc->data.primitive_proc.min_args ||
+     (proc->data.primitive_proc.max_args >= 0 &&
+      argc > proc->data.primitive_proc.max_args))
+    return NULL;
+  if(fn == add_proc || fn == subtract_proc || fn == multiply_proc ||
+     fn == divide_proc || fn == is_equal_proc || fn == is_less_than_proc ||
+     fn == is_greater_than_proc) {
+    for(i = 0; i < argc; i++)
+      if(!is_fixnum(argv[i]) ||
+         (fn == divide_proc && i > 0 && argv[i]->data.fixnum.value == 0))
+        return NULL;
+  }
+  else if(fn == car_proc || fn == cdr_proc) {
+    if(!is_cons(argv[0]))
+      return NULL;
+  }
+  else if(fn == len_proc) {
+    if(!is_proper_list(argv[0]))
+      return NULL;
+  }
+  else if(fn != is_null_proc && fn != is_eq_proc) {
+    return NULL;
+  }
+  return make_literal(fn(argv, argc, the_global_environment));
+}
+
+char is_simple_params(object *params) {
+  for(; is_cons(params); params = cdr(params))
+    if(!is_symbol(car(params)) || car(params) == rest_keyword)
+      return 0;
+  return is_nil(params);
+}
+
+object *append_names(object *names, object *scope) {
+  for(; is_cons(names); names = cdr(names))
+    scope = cons(car(names), scope);
+  return scope;
+}
+
+// a body's scope also holds the names its internal defines bind
+object *optimize_body(object *body, object *scope, object *proc_env,
+                      object **deps) {
+  object *exps;
+
+  for(exps = body; is_cons(exps); exps = cdr(exps))
+    if(is_definition(car(exps)))
+      scope = cons(definition_variable(car(exps)), scope);
+  return optimize_sequence(body, scope, proc_env, deps);
+}
+
+object *optimize_sequence(object *exps, object *scope, object *proc_env,
+                          object **deps) {
+  if(!is_cons(exps))
+    return exps;
+  return cons(optimize(car(exps), scope, proc_env, deps),
+              optimize_sequence(cdr(exps), scope, proc_env, deps));
+}
+
+object *make_frame_binding(object *vars, object *inits, object *body,
+                           object *scope, object *proc_env, object **deps) {
+  return cons(bind_symbol,
+              cons(vars,
+                   cons(optimize_sequence(inits, scope, proc_env, deps),
+                        optimize_body(body, append_names(vars, scope),
+                                      proc_env, deps))));
+}
+
+// inits are optimized in the enclosing scope, the rest where the loop
+// variables are bound
+object *optimize_loop(object *exp, object *scope, object *proc_env,
+                      object **deps) {
+  object *specs, *spec, *inner, *optimized = nil, *last = nil;
+
+  if(!is_cons(cdr(exp)) || !is_cons(cddr(exp)) || !is_cons(caddr(exp)) ||
+     !is_proper_list(cadr(exp)))
+    return exp;
+  inner = scope;
+  for(specs = cadr(exp); !is_nil(specs); specs = cdr(specs)) {
+    if(!is_cons(car(specs)) || !is_symbol(caar(specs)) ||
+       !is_cons(cdar(specs)) || !is_proper_list(car(specs)))
+      return exp;
+    inner = cons(caar(specs), inner);
+  }
+  for(specs = cadr(exp); !is_nil(specs); specs = cdr(specs)) {
+    spec = car(specs);
+    spec = cons(car(spec),
+                cons(optimize(cadr(spec), scope, proc_env, deps),
+                     optimize_sequence(cddr(spec), inner, proc_env, deps)));
+    list_append_item(&optimized, &last, spec);
+  }
+  return cons(car(exp),
+              cons(optimized,
+                   cons(optimize_sequence(caddr(exp), inner, proc_env, deps),
+                        optimize_body(cdddr(exp), inner, proc_env, deps))));
+}
+
+long exp_size(object *exp, long limit) {
+  long size = 0;
+
+  for(; is_cons(exp) && size <= limit; exp = cdr(exp))
+    size += 1 + exp_size(car(exp), limit - size);
+  return size;
+}
+
+// true when a name in exp, other than the callee's own parameters,
+// would mean something else at the call site: a local or closure
+// binding there, or the callee itself
+char names_clash(object *exp, object *params, object *self, object *scope,
+                 object *proc_env) {
+  object *env;
+
+  if(is_symbol(exp)) {
+    if(exp == self)
+      return 1;
+    if(is_member(exp, params))
+      return 0;
+    if(is_member(exp, scope))
+      return 1;
+    for(env = proc_env; !is_nil(env) && env != the_global_environment;
+        env = enclosing_environment(env))
+      if(frame_binding(exp, env))
+        return 1;
+    return 0;
+  }
+  for(; is_cons(exp); exp = cdr(exp))
+    if(names_clash(car(exp), params, self, scope, proc_env))
+      return 1;
+  return 0;
+}
+
+// small, non-recursive global procedures with plain parameters can be
+// copied into a call site that passes all of them
+char is_inlinable(object *name, object *proc, object *args, object *scope,
+                  object *proc_env) {
+  object *params, *body;
+
+  if(!is_compound_proc(proc) ||
+     proc->data.compound_proc.env != the_global_environment)
+    return 0;
+  params = proc->data.compound_proc.parameters;
+  body = proc->data.compound_proc.body;
+  return is_simple_params(params) && is_proper_list(args) &&
+    len(params) == len(args) &&
+    exp_size(body, INLINE_SIZE_MAX) <= INLINE_SIZE_MAX &&
+    !names_clash(body, params, name, scope, proc_env);
+}
+
+__thread int inline_depth = 0;
+
+object *optimize(object *exp, object *scope, object *proc_env, object **deps) {
+  object *op, *args, *value, *pred, *folded, *vars, *inits, *iterator;
+  object *inlined;
+
+  if(is_backquoted(exp) && is_cons(cdr(exp)))
+    return optimize(quasiquote_code(exp), scope, proc_env, deps);
+  if(!is_cons(exp) || is_quoted(exp) || is_backquoted(exp) ||
+     is_piped(exp) || is_macro_def(exp) || is_future_form(exp) ||
+     is_delay(exp) || is_frame_binding(exp) || is_inline_guard(exp))
+    return exp;
+  if(is_lambda(exp))
+    return make_lambda(lambda_parameters(exp),
+                       optimize_body(lambda_body(exp),
+                                     append_names(parse_params(lambda_parameters(exp)),
+                                                  scope),
+                                     proc_env, deps));
+  if(is_while(exp) && is_proper_list(exp))
+    return cons(car(exp), optimize_sequence(cdr(exp), scope, proc_env, deps));
+  if(is_loop(exp))
+    return optimize_loop(exp, scope, proc_env, deps);
+  if(is_definition(exp)) {
+    if(!is_cons(cddr(exp)))
+      return exp;
+    if(is_symbol(cadr(exp)))
+      return cons(define_symbol,
+                  cons(cadr(exp),
+                       cons(optimize(caddr(exp), scope, proc_env, deps), nil)));
+    if(!is_symbol(caadr(exp)))
+      return exp;
+    return cons(define_symbol,
+                cons(caadr(exp),
+                     cons(make_lambda(cdadr(exp),
+                                      optimize_body(cddr(exp),
+                                                    append_names(parse_params(cdadr(exp)),
+                                                                 scope),
+                                                    proc_env, deps)),
+                          nil)));
+  }
+  if(is_assignment(exp)) {
+    if(!is_cons(cddr(exp)))
+      return exp;
+    return cons(set_symbol,
+                cons(cadr(exp),
+                     cons(optimize(caddr(exp), scope, proc_env, deps), nil)));
+  }
+  if(is_if(exp)) {
+    pred = optimize(if_predicate(exp), scope, proc_env, deps);
+    if(pred == t_symbol &&
+       global_value(t_symbol, scope, proc_env, deps) == t_symbol)
+      pred = make_literal(t_symbol);
+    if(is_literal(pred))
+      return optimize(is_nil(literal_value(pred)) ?
+                      if_alternative(exp) : if_consequent(exp),
+                      scope, proc_env, deps);
+    return cons(if_symbol,
+                cons(pred,
+                     optimize_sequence(cddr(exp), scope, proc_env, deps)));
+  }
+  if(is_cond(exp))
+    return optimize(cond_to_if(exp), scope, proc_env, deps);
+  if(is_let(exp)) {
+    vars = inits = nil;
+    for(iterator = cadr(exp); is_cons(iterator); iterator = cdr(iterator)) {
+      if(!is_cons(car(iterator)) || !is_symbol(caar(iterator)) ||
+         !is_cons(cdar(iterator)))
+        return exp;
+      vars = cons(caar(iterator), vars);
+      inits = cons(cadar(iterator), inits);
+    }
+    return make_frame_binding(reverse(vars), reverse(inits), cddr(exp),
+                              scope, proc_env, deps);
+  }
+  if(is_begin(exp))
+    return cons(begin_symbol,
+                optimize_sequence(cdr(exp), scope, proc_env, deps));
+
+  op = car(exp);
+  args = cdr(exp);
+  if(is_lambda(op) && is_simple_params(lambda_parameters(op)) &&
+     is_proper_list(args) && len(lambda_parameters(op)) == len(args))
+    return make_frame_binding(lambda_parameters(op), args, lambda_body(op),
+                              scope, proc_env, deps);
+  if(is_symbol(op) && !is_member(op, scope)) {
+    // the arguments of a macro, or of something that may turn out to
+    // be one, are syntax and are left alone
+    value = global_value(op, scope, proc_env, deps);
+    if(!value || is_macro(value))
+      return exp;
+    args = optimize_sequence(args, scope, proc_env, deps);
+    if(is_primitive_proc(value) && (folded = fold(value, args)))
+      return folded;
+    if(inline_depth < INLINE_DEPTH_MAX &&
+       is_inlinable(op, value, args, scope, proc_env)) {
+      vars = value->data.compound_proc.parameters;
+      inline_depth++;
+      inlined = cons(bind_symbol,
+                     cons(vars,
+                          cons(args,
+                               optimize_body(value->data.compound_proc.body,
+                                             append_names(vars, scope),
+                                             proc_env, deps))));
+      inline_depth--;
+      return cons(guard_symbol,
+                  cons(op,
+                       cons(make_fixnum(dep_version(op, *deps)),
+                            cons(inlined,
+                                 cons(cons(op, args), nil)))));
+    }
+    return cons(op, args);
+  }
+  return optimize_sequence(exp, scope, proc_env, deps);
+}
+
+// a macro's body is kept the same way, so the templates it expands
+// through are translated once
+object *optimized_body(object *proc) {
+  proc_info *info = proc_info_of(proc);
+  long epoch = atomic_load(&binding_epoch);
+  param_descriptor *params = is_macro(proc) ?
+    &proc->data.macro.params : &proc->data.compound_proc.params;
+  object *scope = nil;
+  object *deps = nil;
+  object *body;
+  long i;
+
+  if(info->optimized && info->optimized_epoch == epoch)
+    return info->optimized;
+  if(info->optimized && deps_current(info->deps)) {
+    info->optimized_epoch = epoch;
+    return info->optimized;
+  }
+  for(i = 0; i < params->count; i++)
+    scope = cons(params->slots[i], scope);
+  if(is_macro(proc))
+    body = optimize_body(proc->data.macro.body, scope,
+                         proc->data.macro.env, &deps);
+  else
+    body = optimize_body(proc->data.compound_proc.body, scope,
+                         proc->data.compound_proc.env, &deps);
+  info->deps = deps;
+  info->optimized = body;
+  info->optimized_epoch = epoch;
+  info->escapes_analyzed = 0;
+  // compiled code, if any, was made from the old body
+  atomic_store(&info->code, NULL);
+  atomic_store(&info->calls, 0);
+  info->jit_failed = 0;
+  return body;
+}
+
+/***********/
+/* futures */
+/***********/
+
+// Each worker owns a Chase-Lev deque: the owner pushes and pops at the
+// bottom, thieves steal from the top.  Arrays are never freed when a
+// deque grows, so a thief holding a stale array still reads valid memory.
+typedef struct deque_array {
+  long size;
+  _Atomic(object *) items[];
+} deque_array;
+
+typedef struct worker {
+  _Atomic long top;
+  _Atomic long bottom;
+  _Atomic(deque_array *) array;
+  pthread_t thread;
+  unsigned int seed;
+} worker;
+
+worker workers[WORKERS_MAX];
+int workers_count = 0;
+_Atomic long futures_pending = 0;
+_Atomic int workers_idle = 0;
+pthread_cond_t workers_wakeup = PTHREAD_COND_INITIALIZER;
+pthread_once_t workers_once = PTHREAD_ONCE_INIT;
+__thread worker *current_worker = NULL;
+
+// futures made on threads that own no deque, such as a host's own
+// threads, queue here for the workers to take
+pthread_mutex_t injection_lock = PTHREAD_MUTEX_INITIALIZER;
+object *injected_head = NULL;
+object *injected_tail = NULL;
+_Atomic long injected_count = 0;
+
+deque_array *make_deque_array(long size) {
+  deque_array *array;
+
+  array = malloc(sizeof(deque_array) + size * sizeof(object *));
+  if(!array)
+    error("Could not allocate deque.");
+  array->size = size;
+  return array;
+}
+
+void deque_push(worker *w, object *obj) {
+  long b, t, i;
+  deque_array *array, *grown;
+
+  b = atomic_load(&w->bottom);
+  t = atomic_load(&w->top);
+  array = atomic_load(&w->array);
+  if(b - t > array->size - 1) {
+    grown = make_deque_array(array->size * 2);
+    for(i = t; i < b; i++)
+      atomic_store(&grown->items[i % grown->size],
+                   atomic_load(&array->items[i % array->size]));
+    atomic_store(&w->array, grown);
+    array = grown;
+  }
+  atomic_store(&array->items[b % array->size], obj);
+  atomic_store(&w->bottom, b + 1);
+}
+
+object *deque_pop(worker *w) {
+  long b, t;
+  deque_array *array;
+  object *obj;
+
+  b = atomic_load(&w->bottom) - 1;
+  array = atomic_load(&w->array);
+  atomic_store(&w->bottom, b);
+  t = atomic_load(&w->top);
+  if(t > b) {
+    atomic_store(&w->bottom, b + 1);
+    return NULL;
+  }
+  obj = atomic_load(&array->items[b % array->size]);
+  if(t == b) {
+    // last item: race any thief for it
+    if(!atomic_compare_exchange_strong(&w->top, &t, t + 1))
+      obj = NULL;
+    atomic_store(&w->bottom, b + 1);
+  }
+  return obj;
+}
+
+object *deque_steal(worker *w) {
+  long b, t;
+  deque_array *array;
+  object *obj;
+
+  t = atomic_load(&w->top);
+  b = atomic_load(&w->bottom);
+  if(t >= b)
+    return NULL;
+  array = atomic_load(&w->array);
+  obj = atomic_load(&array->items[t % array->size]);
+  if(!atomic_compare_exchange_strong(&w->top, &t, t + 1))
+    return NULL;
+  return obj;
+}
+
+char is_future(object *obj) {
+  return obj->type == FUTURE;
+}
+
+char claim_future(object *future) {
+  int expected = FUTURE_PENDING;
+  if(atomic_compare_exchange_strong(&future->data.future.state,
+                                    &expected, FUTURE_RUNNING)) {
+    atomic_fetch_sub(&futures_pending, 1);
+    return 1;
+  }
+  return 0;
+}
+
+void run_future(object *future) {
+  iota_context *context = current_context;
+  iota_context *home = future->data.future.context;
+
+  iota_enter(home);
+  future->data.future.value = eval(future->data.future.exp,
+                                   future->data.future.env);
+  iota_enter(context);
+  atomic_store(&future->data.future.state, FUTURE_DONE);
+  if(home)
+    atomic_fetch_sub(&home->futures, 1);
+  context_release(home);
+}
+
+void inject_future(object *future) {
+  object *cell = cons(future, nil);
+
+  pthread_mutex_lock(&injection_lock);
+  if(injected_tail)
+    cdr(injected_tail) = cell;
+  else
+    injected_head = cell;
+  injected_tail = cell;
+  atomic_fetch_add(&injected_count, 1);
+  pthread_mutex_unlock(&injection_lock);
+}
+
+object *take_injected() {
+  object *future = NULL;
+
+  if(atomic_load(&injected_count) == 0)
+    return NULL;
+  pthread_mutex_lock(&injection_lock);
+  if(injected_head) {
+    future = car(injected_head);
+    injected_head = cdr(injected_head);
+    if(is_nil(injected_head))
+      injected_head = injected_tail = NULL;
+    atomic_fetch_sub(&injected_count, 1);
+  }
+  pthread_mutex_unlock(&injection_lock);
+  return future;
+}
+
+// pop local work first, then take injected futures, then steal from the
+// other workers starting at a random victim.  A thread that is not a
+// worker only takes and steals.  Futures already claimed by a touch are
+// dropped.
+object *find_work(worker *self) {
+  object *future;
+  int i, start, count = __atomic_load_n(&workers_count, __ATOMIC_ACQUIRE);
+
+  while(self && (future = deque_pop(self)) != NULL) {
+    if(claim_future(future))
+      return future;
+  }
+  while((future = take_injected()) != NULL) {
+    if(claim_future(future))
+      return future;
+  }
+  if(self && count < 2)
+    return NULL;
+  start = self ? rand_r(&self->seed) % count : 0;
+  for(i = 0; i < count; i++) {
+    worker *victim = &workers[(start + i) % count];
+    if(victim == self)
+      continue;
+    while((future = deque_steal(victim)) != NULL) {
+      if(claim_future(future))
+        return future;
+    }
+  }
+  return NULL;
+}
+
+void *worker_loop(void *arg) {
+  object *future;
+  current_worker = (worker *) arg;
+
+  while(1) {
+    if((future = find_work(current_worker)) != NULL) {
+      run_future(future);
+      continue;
+    }
+    pthread_mutex_lock(&runtime_lock);
+    atomic_fetch_add(&workers_idle, 1);
+    while(atomic_load(&futures_pending) == 0)
+      pthread_cond_wait(&workers_wakeup, &runtime_lock);
+    atomic_fetch_sub(&workers_idle, 1);
+    pthread_mutex_unlock(&runtime_lock);
+  }
+  return NULL;
+}
+
+// the thread that creates the first future becomes worker 0; the rest
+// of the workers are started here, one per online core.  Run once,
+// through workers_once.
+void start_workers() {
+  long cores;
+  int i, count;
+
+  cores = get_nprocs();
+  count = cores < 1 ? 1 : (cores > WORKERS_MAX ? WORKERS_MAX : cores);
+  for(i = 0; i < count; i++) {
+    atomic_store(&workers[i].top, 0);
+    atomic_store(&workers[i].bottom, 0);
+    atomic_store(&workers[i].array, make_deque_array(DEQUE_SIZE_INITIAL));
+    workers[i].seed = i + 1;
+  }
+  __atomic_store_n(&workers_count, count, __ATOMIC_RELEASE);
+  current_worker = &workers[0];
+  for(i = 1; i < workers_count; i++) {
+    if(pthread_create(&workers[i].thread, NULL, worker_loop, &workers[i]) != 0)
+      error("Could not start worker thread.");
+    pthread_detach(workers[i].thread);
+  }
+}
+
+object *make_future(object *exp, object *env) {
+  object *obj;
+
+  pthread_once(&workers_once, start_workers);
+
+  obj = alloc_object();
+  obj->type = FUTURE;
+  obj->data.future.exp = exp;
+  obj->data.future.env = capture_environment(env);
+  obj->data.future.value = nil;
+  obj->data.future.context = current_context;
+  atomic_store(&obj->data.future.state, FUTURE_PENDING);
+  if(current_context)
+    atomic_fetch_add(&current_context->futures, 1);
+  context_retain(current_context);
+
+  atomic_fetch_add(&futures_pending, 1);
+  if(current_worker)
+    deque_push(current_worker, obj);
+  else
+    inject_future(obj);
+  if(atomic_load(&workers_idle) > 0) {
+    pthread_mutex_lock(&runtime_lock);
+    pthread_cond_signal(&workers_wakeup);
+    pthread_mutex_unlock(&runtime_lock);
+  }
+  return obj;
+}
+
+char is_future_form(object *exp) {
+  return is_tagged_list(exp, future_symbol);
+}
+
+// work-first: an unstarted future is run inline by whoever touches it.
+// A future already running elsewhere is waited on by helping with other
+// queued work.
+object *touch(object *obj) {
+  object *work;
+
+  if(!is_future(obj))
+    return obj;
+  if(claim_future(obj))
+    run_future(obj);
+  while(atomic_load(&obj->data.future.state) != FUTURE_DONE) {
+    if((work = find_work(current_worker)) != NULL)
+      run_future(work);
+    else if(tasks_count > 0)
+      task_yield();
+    else
+      sched_yield();
+  }
+  return obj->data.future.value;
+}
+
+// whether one of this thread's tasks from ctx waits on a descriptor
+char context_waits_on_fd(iota_context *ctx) {
+  waiter *w;
+  int fd;
+
+  for(fd = 0; fd < fd_waiters_size; fd++) {
+    for(w = fd_waiters[fd]; w; w = w->next) {
+      if(w->task->home == ctx)
+        return 1;
+    }
+  }
+  return 0;
+}
+
+// before a context closes: wait for the futures started in it, helping
+// with queued work as touch does, and run this thread's tasks while one
+// of ctx's is left and can go on
+void drain_context(iota_context *ctx) {
+  object *work;
+
+  while(atomic_load(&ctx->references) > 1) {
+    if((work = find_work(current_worker)) != NULL)
+      run_future(work);
+    else if(run_queue_head)
+      task_yield();
+    else if(context_waits_on_fd(ctx)) {
+      poll_events(-1);
+      task_yield();
+    }
+    else if(atomic_load(&ctx->futures) > 0)
+      sched_yield();
+    else
+      break;
+  }
+}
+
+object *touch_proc(object *args, object *env) {
+  assert( is_list(args) );
+  return touch(car(args));
+}
+
+object *is_future_proc(object *args, object *env) {
+  assert( is_list(args) );
+  return is_future(car(args)) ? t_symbol : nil;
+}
+
+/************/
+/* channels */
+/************/
+
+// a spawned thunk runs on its own green thread; an error ends only
+// that thread
+void run_thunk_task(void *arg) {
+  object *thunk = arg;
+  escape handler;
+
+  save_escape(&handler);
+  error_handler = &handler;
+  if(setjmp(handler.jump) == 0)
+    apply(thunk, nil, the_global_environment);
+  else
+    fprintf(stderr, "Thread error: %s\n", error_message);
+  error_handler = NULL;
+}
+
+object *spawn_proc(object *args, object *env) {
+  assert( is_list(args) );
+  object *thunk = car(args);
+  assert( is_primitive_proc(thunk) || is_compound_proc(thunk) );
+  make_task(run_thunk_task, thunk);
+  return t_symbol;
+}
+
+object *yield_proc(object *args, object *env) {
+  task_yield();
+  return t_symbol;
+}
+
+object *make_channel(long capacity) {
+  object *obj;
+
+  if(capacity < 1)
+    error("Channel capacity must be positive.");
+  obj = alloc_object();
+  obj->type = CHANNEL;
+  obj->data.channel.items = malloc(capacity * sizeof(object *));
+  if(!obj->data.channel.items)
+    error("Could not allocate channel.");
+  obj->data.channel.capacity = capacity;
+  obj->data.channel.count = 0;
+  obj->data.channel.head = 0;
+  obj->data.channel.senders = NULL;
+  obj->data.channel.receivers = NULL;
+  return obj;
+}
+
+char is_channel(object *obj) {
+  return obj->type == CHANNEL;
+}
+
+// park the current thread at the tail of a channel's wait queue
+void channel_wait(waiter **queue) {
+  waiter w;
+
+  w.task = this_task();
+  w.events = 0;
+  w.next = NULL;
+  while(*queue)
+    queue = &(*queue)->next;
+  *queue = &w;
+  task_park();
+}
+
+void channel_wake(waiter **queue) {
+  waiter *w = *queue;
+
+  if(w) {
+    *queue = w->next;
+    task_wake(w->task);
+  }
+}
+
+void channel_send(object *ch, object *obj) {
+  long tail;
+
+  while(ch->data.channel.count == ch->data.channel.capacity)
+    channel_wait(&ch->data.channel.senders);
+  tail = (ch->data.channel.head + ch->data.channel.count) % ch->data.channel.capacity;
+  ch->data.channel.items[tail] = obj;
+  ch->data.channel.count++;
+  channel_wake(&ch->data.channel.receivers);
+}
+
+object *channel_recv(object *ch) {
+  object *obj;
+
+  while(ch->data.channel.count == 0)
+    channel_wait(&ch->data.channel.receivers);
+  obj = ch->data.channel.items[ch->data.channel.head];
+  ch->data.channel.head = (ch->data.channel.head + 1) % ch->data.channel.capacity;
+  ch->data.channel.count--;
+  channel_wake(&ch->data.channel.senders);
+  return obj;
+}
+
+object *make_channel_proc(object *args, object *env) {
+  assert( is_list(args) );
+  if(is_nil(args))
+    return make_channel(1);
+  assert( is_fixnum(car(args)) );
+  return make_channel(car(args)->data.fixnum.value);
+}
+
+object *is_channel_proc(object *args, object *env) {
+  assert( is_list(args) );
+  return is_channel(car(args)) ? t_symbol : nil;
+}
+
+object *send_proc(object *args, object *env) {
+  assert( is_list(args) );
+  assert( is_channel(car(args)) );
+  channel_send(car(args), cadr(args));
+  return cadr(args);
+}
+
+object *recv_proc(object *args, object *env) {
+  assert( is_list(args) );
+  assert( is_channel(car(args)) );
+  return channel_recv(car(args));
+}
+
+/*************/
+/* sequences */
+/*************/
+
+// (delay exp) is run at most once, by the first force; a thread that
+// races it to the value keeps the one stored first
+object *make_promise(object *exp, object *env) {
+  object *obj;
+
+  obj = alloc_object();
+  obj->type = PROMISE;
+  obj->data.promise.exp = exp;
+  obj->data.promise.env = capture_environment(env);
+  obj->data.promise.value = NULL;
+  return obj;
+}
+
+char is_promise(object *obj) {
+  return obj->type == PROMISE;
+}
+
+char is_delay(object *exp) {
+  return is_tagged_list(exp, delay_symbol);
+}
+
+object *force(object *obj) {
+  object *value, *expected = NULL;
+
+  if(!is_promise(obj))
+    return obj;
+  if((value = __atomic_load_n(&obj->data.promise.value, __ATOMIC_ACQUIRE)))
+    return value;
+  value = eval(obj->data.promise.exp, obj->data.promise.env);
+  if(!__atomic_compare_exchange_n(&obj->data.promise.value, &expected,
+                                  value, 0, __ATOMIC_ACQ_REL,
+                                  __ATOMIC_ACQUIRE))
+    value = expected;
+  return value;
+}
+
+object *force_proc(object **args, long argc, object *env) {
+  return force(args[0]);
+}
+
+// A sequence only describes a pipeline: a source (a list, possibly with
+// delayed tails, or an input stream read form by form) under a chain of
+// map, filter and take stages.  Consuming one opens a cursor per stage
+// and pulls elements through the whole chain one at a time, so stages
+// never build intermediate lists and a sequence can be consumed again.
+object *make_sequence(seqkind kind, object *proc, object *source, long count) {
+  object *obj;
+
+  obj = alloc_object();
+  obj->type = SEQUENCE;
+  obj->data.sequence.kind = kind;
+  obj->data.sequence.proc = proc;
+  obj->data.sequence.source = source;
+  obj->data.sequence.count = count;
+  return obj;
+}
+
+char is_sequence(object *obj) {
+  return obj->type == SEQUENCE;
+}
+
+object *as_sequence(object *obj) {
+  if(is_sequence(obj))
+    return obj;
+  if(is_stream(obj)) {
+    if(obj->data.stream.directiontype != INPUT)
+      error("Not an input stream.");
+    return make_sequence(SEQ_STREAM, nil, obj, 0);
+  }
+  if(is_list(obj) || is_promise(obj))
+    return make_sequence(SEQ_LIST, nil, obj, 0);
+  error("Cannot make a sequence of that.");
+  return nil;
+}
+
+typedef struct seq_cursor {
+  object *seq;
+  object *rest;                 // what a list source has left
+  long left;                    // what a take stage may still pass
+} seq_cursor;
+
+// one cursor per stage, outermost first; returns how many
+long seq_open(object *seq, seq_cursor *cursors) {
+  long n;
+
+  for(n = 0; ; n++) {
+    if(n == SEQ_DEPTH_MAX)
+      error("Sequence pipeline too deep.");
+    cursors[n].seq = seq;
+    cursors[n].rest = seq->data.sequence.source;
+    cursors[n].left = seq->data.sequence.count;
+    if(seq->data.sequence.kind == SEQ_LIST ||
+       seq->data.sequence.kind == SEQ_STREAM)
+      return n + 1;
+    seq = seq->data.sequence.source;
+  }
+}
+
+// the next element out of stage i, or NULL when it has run dry
+object *seq_pull(seq_cursor *cursors, long i, object *env) {
+  seq_cursor *c = &cursors[i];
+  object *proc = c->seq->data.sequence.proc;
+  object *obj;
+
+  switch(c->seq->data.sequence.kind) {
+  case SEQ_LIST:
+    c->rest = force(c->rest);
+    if(!is_cons(c->rest))
+      return NULL;
+    obj = car(c->rest);
+    c->rest = cdr(c->rest);
+    return obj;
+  case SEQ_STREAM:
+    obj = read(c->seq->data.sequence.source, env);
+    return obj == eof_object ? NULL : obj;
+  case SEQ_MAP:
+    if(!(obj = seq_pull(cursors, i + 1, env)))
+      return NULL;
+    return call_procedure(proc, cons(obj, nil), env);
+  case SEQ_FILTER:
+    while((obj = seq_pull(cursors, i + 1, env)))
+      if(!is_nil(call_procedure(proc, cons(obj, nil), env)))
+        return obj;
+    return NULL;
+  case SEQ_TAKE:
+    if(c->left <= 0)
+      return NULL;
+    c->left--;
+    return seq_pull(cursors, i + 1, env);
+  }
+  return NULL;
+}
+
+object *seq_proc(object **args, long argc, object *env) {
+  return as_sequence(args[0]);
+}
+
+object *seq_map_proc(object **args, long argc, object *env) {
+  return make_sequence(SEQ_MAP, args[0], as_sequence(args[1]), 0);
+}
+
+object *seq_filter_proc(object **args, long argc, object *env) {
+  return make_sequence(SEQ_FILTER, args[0], as_sequence(args[1]), 0);
+}
+
+// (seq-take n seq)
+object *seq_take_proc(object **args, long argc, object *env) {
+  if(!is_fixnum(args[0]))
+    error("Not a number.");
+  return make_sequence(SEQ_TAKE, nil, as_sequence(args[1]),
+                       args[0]->data.fixnum.value);
+}
+
+// (seq-fold f init seq): (f x acc) like fold
+object *seq_fold_proc(object **args, long argc, object *env) {
+  seq_cursor cursors[SEQ_DEPTH_MAX];
+  object *acc = args[1], *obj;
+
+  seq_open(as_sequence(args[2]), cursors);
+  while((obj = seq_pull(cursors, 0, env)))
+    acc = call_procedure(args[0], cons(obj, cons(acc, nil)), env);
+  return acc;
+}
+
+object *seq_to_list_proc(object **args, long argc, object *env) {
+  seq_cursor cursors[SEQ_DEPTH_MAX];
+  object *result = nil, *last = nil, *obj;
+
+  seq_open(as_sequence(args[0]), cursors);
+  while((obj = seq_pull(cursors, 0, env)))
+    list_append_item(&result, &last, obj);
+  return result;
+}
+
+/********/
+/* fasl */
+/********/
+
+// A fasl is a header (magic, version, payload length, table size)
+// followed by the payload: a pre-order walk of the object in which
+// every symbol, keyword, string and cons is numbered as it first
+// appears and written as a reference after that.  A cons is numbered
+// before its car is written, so cycles and shared tails come back as
+// they were.  Lengths and fixnums are varints.  The reader pulls the
+// whole payload in with one fread and leaves strings as slices of it.
+
+#define FASL_MAGIC "IFSL"
+#define FASL_VERSION 1
+
+enum {FASL_NIL, FASL_FIXNUM, FASL_CHARACTER, FASL_STRING, FASL_SYMBOL,
+      FASL_KEYWORD, FASL_CONS, FASL_REF, FASL_EOF};
+
+typedef struct fasl_writer {
+  char *bytes;
+  long length;
+  long capacity;
+  object **keys;                // open addressing, object -> number
+  long *numbers;
+  long slots;
+  long count;
+} fasl_writer;
+
+void fasl_emit(fasl_writer *w, void *bytes, long length) {
+  char *grown;
+
+  if(w->length + length > w->capacity) {
+    w->capacity = (w->length + length) * 2 + 256;
+    grown = realloc(w->bytes, w->capacity);
+    if(!grown)
+      error("Could not allocate fasl buffer.");
+    w->bytes = grown;
+  }
+  memcpy(w->bytes + w->length, bytes, length);
+  w->length += length;
+}
+
+void fasl_emit_byte(fasl_writer *w, unsigned char byte) {
+  fasl_emit(w, &byte, 1);
+}
+
+void fasl_emit_varint(fasl_writer *w, unsigned long value) {
+  unsigned char bytes[10];
+  int n = 0;
+
+  do {
+    bytes[n] = value & 0x7f;
+    value >>= 7;
+    if(value)
+      bytes[n] |= 0x80;
+    n++;
+  } while(value);
+  fasl_emit(w, bytes, n);
+}
+
+unsigned long fasl_hash(object *obj) {
+  return ((unsigned long) obj >> 4) * 0x9e3779b97f4a7c15UL;
+}
+
+// the number obj was given, or -1 after numbering it now
+long fasl_number(fasl_writer *w, object *obj) {
+  object **keys;
+  long *numbers, slots, i, j;
+
+  if(w->count * 2 >= w->slots) {
+    slots = w->slots ? w->slots * 2 : 1024;
+    keys = calloc(slots, sizeof(object *));
+    numbers = malloc(slots * sizeof(long));
+    if(!keys || !numbers)
+      error("Could not allocate fasl table.");
+    for(i = 0; i < w->slots; i++) {
+      if(!w->keys[i])
+        continue;
+      for(j = fasl_hash(w->keys[i]) & (slots - 1); keys[j];
+          j = (j + 1) & (slots - 1))
+        ;
+      keys[j] = w->keys[i];
+      numbers[j] = w->numbers[i];
+    }
+    free(w->keys);
+    free(w->numbers);
+    w->keys = keys;
+    w->numbers = numbers;
+    w->slots = slots;
+  }
+  for(i = fasl_hash(obj) & (w->slots - 1); w->keys[i];
+      i = (i + 1) & (w->slots - 1))
+    if(w->keys[i] == obj)
+      return w->numbers[i];
+  w->keys[i] = obj;
+  w->numbers[i] = w->count++;
+  return -1;
+}
+
+// the walk loops down cdrs, so only car nesting uses the C stack
+void fasl_write_object(fasl_writer *w, object *obj) {
+  long number, length;
+  char *chars;
+
+  while(1) {
+    if(obj == eof_object) {
+      fasl_emit_byte(w, FASL_EOF);
+      return;
+    }
+    switch(obj->type) {
+    case NIL:
+      fasl_emit_byte(w, FASL_NIL);
+      return;
+    case FIXNUM:
+      fasl_emit_byte(w, FASL_FIXNUM);
+      // zigzag, so small negative numbers stay short
+      fasl_emit_varint(w, ((unsigned long) obj->data.fixnum.value << 1) ^
+                       (unsigned long) (obj->data.fixnum.value >> 63));
+      return;
+    case CHARACTER:
+      fasl_emit_byte(w, FASL_CHARACTER);
+      fasl_emit_byte(w, obj->data.character.value);
+      return;
+    case STRING:
+    case SYMBOL:
+    case KEYWORD:
+    case CONS:
+      break;
+    default:
+      error("Cannot write that as fasl.");
+    }
+    if((number = fasl_number(w, obj)) >= 0) {
+      fasl_emit_byte(w, FASL_REF);
+      fasl_emit_varint(w, number);
+      return;
+    }
+    if(obj->type == CONS) {
+      fasl_emit_byte(w, FASL_CONS);
+      fasl_write_object(w, car(obj));
+      obj = cdr(obj);
+      continue;
+    }
+    if(obj->type == STRING) {
+      fasl_emit_byte(w, FASL_STRING);
+      chars = obj->data.string.value;
+      length = obj->data.string.length;
+    }
+    else {
+      if(obj->type == SYMBOL && make_symbol(obj->data.symbol.value) != obj)
+        error("Cannot write an uninterned symbol as fasl.");
+      fasl_emit_byte(w, obj->type == SYMBOL ? FASL_SYMBOL : FASL_KEYWORD);
+      chars = obj->type == SYMBOL ? obj->data.symbol.value :
+        obj->data.keyword.value;
+      length = strlen(chars);
+    }
+    fasl_emit_varint(w, length);
+    fasl_emit(w, chars, length);
+    return;
+  }
+}
+
+void write_fasl(object *obj, FILE *out) {
+  fasl_writer w = {0};
+  fasl_writer header = {0};
+
+  fasl_write_object(&w, obj);
+  fasl_emit(&header, FASL_MAGIC, 4);
+  fasl_emit_byte(&header, FASL_VERSION);
+  fasl_emit_varint(&header, w.length);
+  fasl_emit_varint(&header, w.count);
+  fwrite(header.bytes, 1, header.length, out);
+  fwrite(w.bytes, 1, w.length, out);
+  fflush(out);
+  free(header.bytes);
+  free(w.bytes);
+  free(w.keys);
+  free(w.numbers);
+}
+
+typedef struct fasl_reader {
+  unsigned char *bytes;
+  long length;
+  long position;
+  object **table;
+  long table_size;
+  long count;
+} fasl_reader;
+
+unsigned char fasl_byte(fasl_reader *r) {
+  if(r->position >= r->length)
+    error("Truncated fasl.");
+  return r->bytes[r->position++];
+}
+
+unsigned long fasl_varint(fasl_reader *r) {
+  unsigned long value = 0;
+  unsigned char byte;
+  int shift = 0;
+
+  do {
+    if(shift > 63)
+      error("Bad fasl varint.");
+    byte = fasl_byte(r);
+    value |= (unsigned long) (byte & 0x7f) << shift;
+    shift += 7;
+  } while(byte & 0x80);
+  return value;
+}
+
+// a varint read straight off the stream, for the header
+unsigned long fasl_stream_varint(FILE *in) {
+  unsigned long value = 0;
+  int c, shift = 0;
+
+  do {
+    if((c = getc(in)) == EOF || shift > 63)
+      error("Truncated fasl.");
+    value |= (unsigned long) (c & 0x7f) << shift;
+    shift += 7;
+  } while(c & 0x80);
+  return value;
+}
+
+object *fasl_numbered(fasl_reader *r, object *obj) {
+  if(r->count >= r->table_size)
+    error("Bad fasl table.");
+  r->table[r->count++] = obj;
+  return obj;
+}
+
+object *fasl_read_object(fasl_reader *r) {
+  object *head = NULL, *cell, *obj, **hole = &head;
+  unsigned long value, length;
+  unsigned char tag;
+  char *chars;
+
+  while((tag = fasl_byte(r)) == FASL_CONS) {
+    cell = fasl_numbered(r, cons(nil, nil));
+    *hole = cell;
+    cell->data.cons.first = fasl_read_object(r);
+    hole = &cell->data.cons.rest;
+  }
+  switch(tag) {
+  case FASL_NIL:
+    obj = nil;
+    break;
+  case FASL_EOF:
+    obj = eof_object;
+    break;
+  case FASL_FIXNUM:
+    value = fasl_varint(r);
+    obj = make_fixnum((long) (value >> 1) ^ -(long) (value & 1));
+    break;
+  case FASL_CHARACTER:
+    obj = make_character(fasl_byte(r));
+    break;
+  case FASL_REF:
+    value = fasl_varint(r);
+    if(value >= (unsigned long) r->count)
+      error("Bad fasl reference.");
+    obj = r->table[value];
+    break;
+  case FASL_STRING:
+  case FASL_SYMBOL:
+  case FASL_KEYWORD:
+    length = fasl_varint(r);
+    if(length > (unsigned long) (r->length - r->position))
+      error("Truncated fasl.");
+    chars = (char *) r->bytes + r->position;
+    r->position += length;
+    if(tag == FASL_STRING)
+      obj = make_string_slice(chars, length);
+    else {
+      if(!(chars = strndup(chars, length)))
+        error("Could not allocate symbol.");
+      obj = tag == FASL_SYMBOL ? make_symbol(chars) : make_keyword(chars);
+      free(chars);
+    }
+    fasl_numbered(r, obj);
+    break;
+  default:
+    error("Bad fasl tag.");
+  }
+  *hole = obj;
+  return head;
+}
+
+// the payload buffer is never freed: strings are slices of it
+object *read_fasl(FILE *in) {
+  fasl_reader r = {0};
+  char magic[4];
+  object *obj;
+
+  if(fread(magic, 1, 4, in) != 4) {
+    if(feof(in))
+      return eof_object;
+    error("Truncated fasl.");
+  }
+  if(memcmp(magic, FASL_MAGIC, 4) != 0)
+    error("Not a fasl.");
+  if(getc(in) != FASL_VERSION)
+    error("Unsupported fasl version.");
+  r.length = fasl_stream_varint(in);
+  r.table_size = fasl_stream_varint(in);
+  // strings are read as slices of the payload, and string_cstr looks
+  // one byte past a slice's end, so the payload ends in a NUL
+  r.bytes = malloc(r.length + 1);
+  r.table = malloc(r.table_size ? r.table_size * sizeof(object *) : 1);
+  if(!r.bytes || !r.table)
+    error("Could not allocate fasl buffer.");
+  if(fread(r.bytes, 1, r.length, in) != (size_t) r.length)
+    error("Truncated fasl.");
+  r.bytes[r.length] = '\0';
+  obj = fasl_read_object(&r);
+  free(r.table);
+  return obj;
+}
+
+object *write_fasl_proc(object **args, long argc, object *env) {
+  write_fasl(args[0], stream_arg(args, argc, 1, OUTPUT, env));
+  return t_symbol;
+}
+
+object *read_fasl_proc(object **args, long argc, object *env) {
+  return read_fasl(stream_arg(args, argc, 0, INPUT, env));
+}
+
+void write_pair(object *cons, object *out_stream, object *env) {
+  FILE *out;
   assert( is_list(cons) );
 
   if(out_stream == stdout_stream)
-    out_stream = eval(stdout_symbol, env);
+    out_stream = lookup_variable_value(stdout_symbol, env);
   out = out_stream->data.stream.fp;
   
   write(car(cons), out_stream, env);
@@ -1714,7 +5778,7 @@ void write_pair(object *cons, object *out_stream, object *env) {
 void write(object *obj, object *out_stream, object *env) {
   FILE *out;
   if(out_stream == stdout_stream)
-    out_stream = eval(stdout_symbol, env);
+    out_stream = lookup_variable_value(stdout_symbol, env);
   out = out_stream->data.stream.fp;
   switch(obj->type) {
   case NIL:
@@ -1733,7 +5797,8 @@ void write(object *obj, object *out_stream, object *env) {
     fprintf(out,"#%c",obj->data.character.value);
     break;
   case STRING:
-    fprintf(out,"\"%s\"",obj->data.string.value);
+    fprintf(out,"\"%.*s\"",(int) obj->data.string.length,
+            obj->data.string.value);
     break;
   case CONS:
     fprintf(out,"(");
@@ -1750,6 +5815,24 @@ void write(object *obj, object *out_stream, object *env) {
   case STREAM:
     fprintf(out,"#<stream>");
     break;
+  case FUTURE:
+    fprintf(out,"#<future>");
+    break;
+  case CHANNEL:
+    fprintf(out,"#<channel>");
+    break;
+  case PROMISE:
+    fprintf(out,"#<promise>");
+    break;
+  case SEQUENCE:
+    fprintf(out,"#<sequence>");
+    break;
+  case STRING_BUILDER:
+    fprintf(out,"#<string-builder>");
+    break;
+  case FRAME:
+    fprintf(out,"#<environment>");
+    break;
   default:
     error("Cannot write unknown type.");
   }
@@ -1762,7 +5845,7 @@ object *write_proc(object *args, object *env) {
 
   obj = car(args);
   if(is_nil(cdr(args)))
-    out_stream = eval(make_symbol("*stdout*"), env);
+    out_stream = lookup_variable_value(stdout_symbol, env);
   else
     out_stream = cadr(args);
 
@@ -1774,6 +5857,312 @@ object *write_proc(object *args, object *env) {
   return t_symbol;
 }
 
+/***********/
+/* modules */
+/***********/
+
+// (load "file") evaluates a source file one form at a time, expanding
+// every macro use in a form just before it runs, and saves the
+// expanded forms as a fasl next to the source (foo.l -> foo.iotac).
+// The next load replays that instead of reading and expanding again,
+// as long as the source's mtime and size and the build that wrote it
+// still match.  (require 'mod) loads mod.l from *load-path* once.
+
+// the Makefile stamps the build with a checksum of the runtime source,
+// so iota, iotac and libiota built from one tree accept each other's
+// files
+#ifndef IOTA_BUILD_STAMP
+#define IOTA_BUILD_STAMP __DATE__ " " __TIME__
+#endif
+
+#define MODULE_VERSION "iota-module 1 " IOTA_BUILD_STAMP
+
+object *expand(object *exp, object *locals);
+
+object *expand_list(object *exps, object *locals) {
+  if(!is_cons(exps))
+    return exps;
+  return cons(expand(car(exps), locals),
+              expand_list(cdr(exps), locals));
+}
+
+object *add_locals(object *params, object *locals) {
+  while(is_cons(params)) {
+    if(is_symbol(car(params)))
+      locals = cons(car(params), locals);
+    params = cdr(params);
+  }
+  return locals;
+}
+
+// internal defines shadow globals for the whole body
+object *expand_body(object *body, object *locals) {
+  object *iterator;
+
+  for(iterator = body; is_cons(iterator); iterator = cdr(iterator))
+    if(is_definition(car(iterator)))
+      locals = cons(definition_variable(car(iterator)), locals);
+  return expand_list(body, locals);
+}
+
+object *expand_bindings(object *bindings, object *locals) {
+  object *binding;
+
+  if(!is_cons(bindings))
+    return bindings;
+  binding = car(bindings);
+  if(is_cons(binding))
+    binding = cons(car(binding), expand_list(cdr(binding), locals));
+  return cons(binding, expand_bindings(cdr(bindings), locals));
+}
+
+// the names a let or loop binds, skipping malformed bindings
+object *add_binding_locals(object *bindings, object *locals) {
+  for(; is_cons(bindings); bindings = cdr(bindings))
+    if(is_cons(car(bindings)) && is_symbol(caar(bindings)))
+      locals = cons(caar(bindings), locals);
+  return locals;
+}
+
+// a special form that binds names expanded with them shadowing any
+// macros, NULL if exp is not one
+object *expand_special(object *exp, object *locals) {
+  object *head = car(exp);
+
+  if(head == lambda_symbol || head == macro_symbol)
+    return cons(head, cons(cadr(exp),
+                           expand_body(cddr(exp),
+                                       add_locals(cadr(exp), locals))));
+  if(head == define_symbol) {
+    if(is_cons(cadr(exp)))
+      return cons(head, cons(cadr(exp),
+                             expand_body(cddr(exp),
+                                         add_locals(cdadr(exp), locals))));
+    return cons(head, cons(cadr(exp), expand_list(cddr(exp), locals)));
+  }
+  if(head == set_symbol)
+    return cons(head, cons(cadr(exp), expand_list(cddr(exp), locals)));
+  if(head == let_symbol && !is_symbol(cadr(exp)))
+    return cons(head,
+                cons(expand_bindings(cadr(exp), locals),
+                     expand_body(cddr(exp),
+                                 add_binding_locals(cadr(exp), locals))));
+  if(head == loop_symbol) {
+    locals = add_binding_locals(cadr(exp), locals);
+    return cons(head, cons(expand_bindings(cadr(exp), locals),
+                           expand_list(cddr(exp), locals)));
+  }
+  if(head == cond_symbol)
+    return cons(head, expand_bindings(cdr(exp), locals));
+  return NULL;
+}
+
+// Expand every macro call in exp whose macro is bound globally right
+// now, leaving quoted and backquoted data alone.
+object *expand(object *exp, object *locals) {
+  object *head, *expanded;
+  binding *global;
+
+  if(!is_cons(exp))
+    return exp;
+  head = car(exp);
+  if(is_symbol(head) && !is_member(head, locals)) {
+    if(head == quote_symbol || head == backquote_symbol)
+      return exp;
+    if(is_cons(cdr(exp)) && (expanded = expand_special(exp, locals)))
+      return expanded;
+    global = find_binding(head, the_global_environment);
+    if(global && is_macro(global->value))
+      return expand(macroexpand(global->value, copy_list(cdr(exp))),
+                    locals);
+  }
+  return expand_list(exp, locals);
+}
+
+// a form whose expansion fails runs as written, so a bad macro use in
+// a branch that is never taken still only fails if it is reached
+object *try_expand_macros(object *exp) {
+  escape *volatile saved_handler = error_handler;
+  object *volatile result = exp;
+  escape handler;
+
+  save_escape(&handler);
+  error_handler = &handler;
+  if(setjmp(handler.jump) == 0)
+    result = expand(exp, nil);
+  else
+    restore_escape(&handler);
+  error_handler = saved_handler;
+  return result;
+}
+
+char *module_cache_name(char *file_name) {
+  size_t length = strlen(file_name);
+  char *name;
+
+  if(length > 2 && strcmp(file_name + length - 2, ".l") == 0)
+    length -= 2;
+  if(!(name = malloc(length + sizeof(".iotac.tmp"))))
+    error("Could not allocate file name.");
+  memcpy(name, file_name, length);
+  strcpy(name + length, ".iotac");
+  return name;
+}
+
+// what a cache has to match: the build, then the source's mtime and size
+object *module_stamp(struct stat *source) {
+  return cons(make_string(MODULE_VERSION),
+              cons(make_fixnum(source->st_mtim.tv_sec),
+                   cons(make_fixnum(source->st_mtim.tv_nsec),
+                        cons(make_fixnum(source->st_size), nil))));
+}
+
+char is_same_stamp(object *a, object *b) {
+  for(; is_cons(a) && is_cons(b); a = cdr(a), b = cdr(b))
+    if(!is_eq(car(a), car(b)))
+      return 0;
+  return is_nil(a) && is_nil(b);
+}
+
+// the cached forms if the cache is current, NULL to read the source
+object *read_module_cache(char *cache_name, object *stamp) {
+  escape *volatile saved_handler = error_handler;
+  object *volatile forms = NULL;
+  escape handler;
+  object *cached;
+  FILE *in;
+
+  if(!(in = fopen(cache_name, "rb")))
+    return NULL;
+  save_escape(&handler);
+  error_handler = &handler;
+  if(setjmp(handler.jump) == 0) {
+    cached = read_fasl(in);
+    if(is_cons(cached) && is_same_stamp(car(cached), stamp))
+      forms = cdr(cached);
+  }
+  else
+    restore_escape(&handler);
+  error_handler = saved_handler;
+  fclose(in);
+  return forms;
+}
+
+// written under a temporary name of its own and renamed, so a
+// concurrent load never sees half a cache and two loads writing the
+// same cache do not clobber each other's file; a form fasl cannot hold
+// means no cache
+void write_module_cache(char *cache_name, object *stamp, object *forms) {
+  escape *volatile saved_handler = error_handler;
+  volatile char written = 0;
+  char *temp_name;
+  escape handler;
+  FILE *out;
+  int fd;
+
+  temp_name = malloc(strlen(cache_name) + sizeof(".XXXXXX"));
+  if(!temp_name)
+    return;
+  strcpy(temp_name, cache_name);
+  strcat(temp_name, ".XXXXXX");
+  if((fd = mkstemp(temp_name)) < 0) {
+    free(temp_name);
+    return;
+  }
+  fchmod(fd, 0644);
+  if(!(out = fdopen(fd, "wb"))) {
+    close_fd(fd);
+    remove(temp_name);
+    free(temp_name);
+    return;
+  }
+  save_escape(&handler);
+  error_handler = &handler;
+  if(setjmp(handler.jump) == 0) {
+    write_fasl(cons(stamp, forms), out);
+    written = 1;
+  }
+  else
+    restore_escape(&handler);
+  error_handler = saved_handler;
+  if(fclose(out) == 0 && written)
+    rename(temp_name, cache_name);
+  else
+    remove(temp_name);
+  free(temp_name);
+}
+
+void load_file(char *file_name) {
+  object *stream, *stamp, *forms, *exp;
+  object *head = nil, *last = nil;
+  struct stat source;
+  char *cache_name;
+
+  if(stat(file_name, &source) != 0)
+    error("Could not open file.");
+  cache_name = module_cache_name(file_name);
+  stamp = module_stamp(&source);
+  if((forms = read_module_cache(cache_name, stamp))) {
+    free(cache_name);
+    for(; is_cons(forms); forms = cdr(forms))
+      eval(car(forms), the_global_environment);
+    return;
+  }
+  stream = make_file_stream(file_name, INPUT);
+  while((exp = read(stream, the_global_environment)) != eof_object) {
+    exp = try_expand_macros(exp);
+    list_append_item(&head, &last, exp);
+    eval(exp, the_global_environment);
+  }
+  close_stream(stream);
+  write_module_cache(cache_name, stamp, head);
+  free(cache_name);
+}
+
+object *load_proc(object **args, long argc, object *env) {
+  if(!is_string(args[0]))
+    error("load needs a file name.");
+  load_file(string_cstr(args[0]));
+  return t_symbol;
+}
+
+// (require 'mod) loads mod.l from the first directory on *load-path*
+// that has it, unless mod has been required already
+object *require_proc(object **args, long argc, object *env) {
+  object *dirs, *module = args[0];
+  char *name, *path;
+  struct stat source;
+
+  if(!is_symbol(module))
+    error("require needs a module name.");
+  for(dirs = current_context->loaded_modules; is_cons(dirs);
+      dirs = cdr(dirs))
+    if(car(dirs) == module)
+      return t_symbol;
+  name = module->data.symbol.value;
+  for(dirs = lookup_variable_value(load_path_symbol, the_global_environment);
+      is_cons(dirs); dirs = cdr(dirs)) {
+    if(!is_string(car(dirs)))
+      continue;
+    path = malloc(car(dirs)->data.string.length + strlen(name) + 4);
+    if(!path)
+      error("Could not allocate file name.");
+    sprintf(path, "%.*s/%s.l", (int) car(dirs)->data.string.length,
+            car(dirs)->data.string.value, name);
+    if(stat(path, &source) == 0) {
+      // marked first so modules that require each other terminate
+      current_context->loaded_modules =
+        cons(module, current_context->loaded_modules);
+      load_file(path);
+      free(path);
+      return t_symbol;
+    }
+    free(path);
+  }
+  error("Module not found.");
+  return nil;
+}
+
 /********/
 /* repl */
 /********/
@@ -1798,31 +6187,98 @@ void repl() {
   object *evaled_lisp_thing;
   object *out_stream;
   printf("C-c to exit.\n");
-  out_stream = eval(stdout_symbol, the_global_environment);
+  out_stream = dynamic_value(stdout_symbol);
   while(1) {
     fprintf(stdout_stream->data.stream.fp,"=> ");
     read_lisp_thing = read(stdin_stream, the_global_environment);
     evaled_lisp_thing = eval(read_lisp_thing, the_global_environment);
     write(evaled_lisp_thing, stdout_stream, the_global_environment);
-    out_stream = eval(stdout_symbol, the_global_environment);
+    out_stream = dynamic_value(stdout_symbol);
     fprintf(out_stream->data.stream.fp,"\n");
   }
 }
 
-int main() {
-  char bootstrap_code_fname[128] = "bootstrap.l";
-  object *bootstrap_stream;
-  printf("Iota-Bootstrap.\n");
-  
-  printf("Initializing core...\n");
-  init();
-  
-  printf("Bootstrapping iota...\n");
-  bootstrap_stream = make_file_stream(bootstrap_code_fname, INPUT);
-  read_eval_file(bootstrap_stream);
-  close_stream(bootstrap_stream);
+/**********/
+/* server */
+/**********/
 
-  repl();
+int connections_count = 0;
 
-  return 0;
+// one green thread per client: an ordinary read-eval-print loop over
+// socket streams, parking whenever the socket is not ready
+void serve_connection(void *arg) {
+  int fd = (int) (long) arg;
+  escape handler;
+  object *in_stream, *out_stream;
+  object *volatile obj;
+  FILE *out;
+
+  in_stream = make_fd_stream(fd, INPUT);
+  out_stream = make_fd_stream(fcntl(fd, F_DUPFD_CLOEXEC, 0), OUTPUT);
+  out = out_stream->data.stream.fp;
+  dynamic_bind(stdin_symbol, in_stream);
+  dynamic_bind(stdout_symbol, out_stream);
+
+  save_escape(&handler);
+  error_handler = &handler;
+  while(1) {
+    if(setjmp(handler.jump) == 0) {
+      obj = read(in_stream, the_global_environment);
+      if(obj == eof_object)
+        break;
+      obj = eval(obj, the_global_environment);
+      write(obj, out_stream, the_global_environment);
+      fprintf(out, "\n");
+    }
+    else {
+      restore_escape(&handler);
+      fprintf(out, "error: %s\n", error_message);
+      clearerr(in_stream->data.stream.fp);
+    }
+    fflush(out);
+  }
+  error_handler = NULL;
+
+  fflush(out);
+  close_stream(in_stream);
+  close_stream(out_stream);
+  connections_count--;
+}
+
+// serve a repl per TCP client on localhost:port.  Every client gets its
+// own socket-backed *stdin*/*stdout*; the root accepts while the
+// scheduler multiplexes the clients.
+void serve(int port) {
+  struct sockaddr_in addr;
+  int listener, fd, on = 1;
+
+  listener = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+  if(listener < 0)
+    error("Could not create socket.");
+  setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(port);
+  if(bind(listener, (struct sockaddr *) &addr, sizeof(addr)) < 0 ||
+     listen(listener, SOMAXCONN) < 0)
+    error("Could not listen on port.");
+
+  printf("Serving on port %d.\n", port);
+  fflush(stdout);
+  while(1) {
+    fd = accept4(listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if(fd < 0) {
+      if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+        error("Could not accept connection.");
+      wait_for_fd(listener, EPOLLIN);
+      continue;
+    }
+    if(connections_count >= CONNECTIONS_MAX) {
+      close_fd(fd);
+      continue;
+    }
+    connections_count++;
+    make_task(serve_connection, (void *) (long) fd);
+  }
 }
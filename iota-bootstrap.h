@@ -1,54 +1,204 @@
 #ifndef BOOTSTRAP_IOTA_H
 #define BOOTSTRAP_IOTA_H
 
+#include <stdio.h>
+
+#include "iota.h"
+
 typedef enum {NIL, SYMBOL, KEYWORD,
               FIXNUM, CHARACTER, STRING,
               CONS, MACRO, PRIMITIVE_PROC,
-              COMPOUND_PROC, STREAM} object_type;
+              COMPOUND_PROC, STREAM, FUTURE,
+              CHANNEL, FRAME, PROMISE,
+              SEQUENCE, STRING_BUILDER} object_type;
 
 typedef enum {OUTPUT, INPUT} directiontype;
 
+typedef enum {FUTURE_PENDING, FUTURE_RUNNING, FUTURE_DONE} futurestate;
+
+typedef enum {SEQ_LIST, SEQ_STREAM, SEQ_MAP, SEQ_FILTER, SEQ_TAKE} seqkind;
+
+typedef enum {TASK_RUNNABLE, TASK_PARKED, TASK_DONE} taskstate;
+
+typedef struct task task;
+typedef struct waiter waiter;
+
 typedef struct object object;
 
+// a parameter list digested once: names of the frame slots in order,
+// how many are required and whether the last one takes the rest
+typedef struct param_descriptor {
+  struct object **slots;
+  long count;
+  long required;
+  char rest;
+} param_descriptor;
+
+typedef struct binding {
+  struct object *name;
+  struct object *value;
+} binding;
+
+struct object {
+  object_type type;
+  union {
+    struct {
+      char *value;
+      long version;             // bumped when its global binding changes
+      char watched;             // some optimized body depends on it
+      long dynamic;             // 1 + its dynamic slot, or 0
+      long global_index;        // 1 + its slot in the global frame, or 0
+    } symbol;
+    struct {
+      char *value;
+    } keyword;
+    struct {
+      long value;
+    } fixnum;
+    struct {
+      char value;
+    } character;
+    struct {
+      char *value;              // NUL-terminated unless a slice
+      long length;
+    } string;
+    struct {
+      struct object *first;
+      struct object *rest;
+    } cons;
+    struct {
+      struct object * (*fn)(struct object *args, struct object *env);
+      struct object * (*array_fn)(struct object **args, long argc,
+                                  struct object *env);
+      int min_args;
+      int max_args;
+    } primitive_proc;
+    struct {
+      struct object *parameters;
+      struct object *body;
+      struct object *env;
+      struct proc_info *info;
+      param_descriptor params;
+    } compound_proc;
+    struct {
+      struct object *parameters;
+      struct object *body;
+      struct object *env;
+      struct proc_info *info;
+      param_descriptor params;
+    } macro;
+    struct {
+      directiontype directiontype;
+      FILE* fp;
+      char *buffer;             // of an output string stream
+      size_t size;
+    } stream;
+    struct {
+      struct object *exp;
+      struct object *env;
+      struct object *value;
+      iota_context *context;    // the one it was made in
+      _Atomic int state;
+    } future;
+    struct {
+      struct object **items;
+      long capacity;
+      long count;
+      long head;
+      struct waiter *senders;
+      struct waiter *receivers;
+    } channel;
+    struct {
+      struct object *parent;
+      binding *bindings;        // starts out right after the object
+      long count;
+      long capacity;
+      char region;              // lives on the evaluator stack
+      struct object *promoted;  // heap copy made when a closure captured it
+    } frame;
+    struct {
+      struct object *exp;
+      struct object *env;
+      struct object *value;     // NULL until forced
+    } promise;
+    struct {
+      seqkind kind;
+      struct object *proc;      // of a map or filter stage
+      struct object *source;    // list, stream or the sequence pulled from
+      long count;               // of a take stage
+    } sequence;
+    struct {
+      char *buffer;
+      long length;
+      long capacity;
+    } string_builder;
+  } data;
+};
+
 // fundamental things, symbols, streams, etc
-object *nil;
-object *t_symbol;
-object *symbol_table;
-object *keyword_table;
-object *quote_symbol;
-object *backquote_symbol;
-object *comma_symbol;
-object *pipe_symbol;
-object *comma_at_symbol;
-object *define_symbol;
-object *set_symbol;
-object *if_symbol;
-object *cond_symbol;
-object *else_symbol;
-object *lambda_symbol;
-object *let_symbol;
-object *begin_symbol;
-object *macro_symbol;
-object *rest_keyword;
-object *eof_object;
-object *stdin_stream;
-object *stdout_stream;
-object *stdin_symbol;
-object *stdout_symbol;
-object *output_keyword;
-object *input_keyword;
-object *the_empty_environment;
-object *the_global_environment;
+extern object *nil;
+extern object *t_symbol;
+extern object *symbol_table;
+extern object *keyword_table;
+extern object *quote_symbol;
+extern object *backquote_symbol;
+extern object *comma_symbol;
+extern object *pipe_symbol;
+extern object *comma_at_symbol;
+extern object *define_symbol;
+extern object *set_symbol;
+extern object *if_symbol;
+extern object *cond_symbol;
+extern object *else_symbol;
+extern object *lambda_symbol;
+extern object *let_symbol;
+extern object *dynamic_let_symbol;
+extern object *while_symbol;
+extern object *loop_symbol;
+extern object *delay_symbol;
+extern object *begin_symbol;
+extern object *macro_symbol;
+extern object *future_symbol;
+extern object *bind_symbol;
+extern object *guard_symbol;
+extern object *quasi_cons;
+extern object *quasi_append;
+extern object *rest_keyword;
+extern object *eof_object;
+extern object *stdin_stream;
+extern object *stdout_stream;
+extern object *stdin_symbol;
+extern object *stdout_symbol;
+extern object *output_keyword;
+extern object *input_keyword;
+extern object *timeout_keyword;
+extern object *the_empty_environment;
+extern __thread object *the_global_environment;
 
 // constructors
 object *alloc_object();
 object *make_symbol(char *value);
+object *make_uninterned_symbol(char *value);
 object *make_keyword(char *value);
 object *make_fixnum(long value);
 object *make_character(char value);
 object *make_string(char *value);
+object *make_string_slice(char *start, long length);
+char *string_cstr(object *str);
 object *make_file_stream(char* stream_name, directiontype direction);
+object *make_fd_stream(int fd, directiontype direction);
+object *make_stdio_stream(FILE *fp, directiontype direction);
+object *make_output_string_stream();
+object *make_input_string_stream(object *str);
+object *output_string(object *stream);
 object *make_primitive_proc(object *(*fn)(struct object *args, struct object *env));
+object *make_array_primitive_proc(object *(*array_fn)(struct object **args,
+                                                      long argc,
+                                                      struct object *env),
+                                  int min_args, int max_args);
+object *call_array_primitive(object *proc, object **args, long argc,
+                             object *env);
+object *apply_array_primitive(object *proc, object *args, object *env);
 object *make_macro(object *params,
                    object *body,
                    object *env);
@@ -68,6 +218,7 @@ object *cons(object *first, object *rest);
 #define cdddr(X) (cdr(cdr(cdr(X))))
 #define cadr(X) (car(cdr(X)))
 #define cdar(X) (cdr(car(X)))
+#define cddar(X) (cdr(cdr(car(X))))
 #define cdadr(X) (cdr(car(cdr(X))))
 #define caddr(X) (car(cdr(cdr(X))))
 #define cadddr(X) (car(cdr(cdr(cdr(X)))))
@@ -88,6 +239,7 @@ char is_keyword(object *obj);
 char is_fixnum(object *obj);
 char is_character(object *obj);
 char is_string(object *obj);
+char is_string_builder(object *obj);
 char is_cons(object *obj);
 char is_list(object *obj);
 char is_atom(object *obj);
@@ -118,17 +270,18 @@ char is_application(object *exp);
 char is_no_operands(object *ops);
 
 //environment
-object *make_frame(object *variables, object *values);
+object *make_frame(object *parent, long capacity);
+char is_environment(object *obj);
 object *enclosing_environment(object *env);
-object *first_frame(object *env);
-object *frame_variables(object *frame);
-object *frame_values(object *frame);
 void add_binding_to_frame(object *var,
                           object *val,
                           object *frame);
 object *extend_environment(object *vars,
                            object *vals,
                            object *base_env);
+object *bind_frame(param_descriptor *d, object *args, object *base_env);
+object *bind_region_frame(param_descriptor *d, object *args, object *base_env);
+object *capture_environment(object *env);
 object *lookup_variable_value(object *var, object *env);
 void set_variable_value(object *var,
                         object *val,
@@ -137,6 +290,12 @@ void define_variable(object *var,
                      object *val,
                      object *env);
 object *setup_environment();
+char is_dynamic(object *var);
+void make_dynamic(object *var);
+object *dynamic_value(object *var);
+void dynamic_bind(object *var, object *val);
+long dynamic_depth();
+void dynamic_unwind(long depth);
 object *assignment_variable(object *exp);
 object *assignment_value(object *exp);
 object *definition_variable(object *exp);
@@ -150,8 +309,8 @@ object *operator(object *exp);
 object *operands(object *exp);
 object *first_operand(object *ops);
 object *rest_operands(object *ops);
-object *parse_args(object *args, object *params);
 object *parse_params(object *params);
+void describe_params(object *params, param_descriptor *d);
 object *prepare_args_for_apply(object *args);
 object *apply(object *proc, object *args, object *env);
 object *apply_macro(object *proc, object *args, object *env);
@@ -185,8 +344,109 @@ object *eval_assignment(object *exp, object *env);
 object *eval_definition(object *exp, object *env);
 object *eval_sequence(object *exps, object *env);
 object *eval_sequence_head(object *exp, object *env);
-object *maybe_eval_backquoted(object *exp, object *env, int backquote_depth);
-object *eval_backquoted(object *exp, object *env, int backquote_depth);
+object *splice_proc(object **args, long argc, object *env);
+object *quasiquote(object *template, int depth);
+object *quasiquote_code(object *exp);
+object *let_to_frame_binding(object *exp);
+object *desugared(object *exp);
+char is_dynamic_let(object *exp);
+object *eval_dynamic_let(object *exp, object *env);
+char is_while(object *exp);
+char is_loop(object *exp);
+object *eval_top_level_loop(object *exp, object *env);
+object *eval_while(object *exp, object *env);
+object *eval_loop(object *exp, object *env);
+
+//tasks
+task *this_task();
+task *make_task(void (*entry)(void *arg), void *arg);
+void free_task(task *t);
+void task_switch(task *from, task *to);
+void task_wake(task *t);
+void task_park();
+void task_yield();
+void run_scheduler();
+void poll_events(int timeout);
+void wait_for_fd(int fd, int events);
+
+//fuel
+typedef struct escape escape;
+extern __thread long fuel;
+#define consume_fuel() do { if(--fuel <= 0) fuel_exhausted(); } while(0)
+void save_escape(escape *e);
+void restore_escape(escape *e);
+long fuel_steps();
+void fuel_refill();
+void fuel_exhausted();
+object *with_budget(long steps, object *thunk, object *env);
+
+//jit
+typedef struct proc_info proc_info;
+void jit_init();
+void jit_note_binding(object *var);
+proc_info *find_proc_info(object *body);
+void jit_compile(proc_info *info, object *proc);
+proc_info *proc_info_of(object *proc);
+object *jit_run(object *proc, object *env);
+char may_capture(object *exp);
+char frame_escapes(object *proc);
+
+//optimize
+char is_literal(object *exp);
+object *make_literal(object *value);
+char is_member(object *obj, object *list);
+char is_proper_list(object *obj);
+void note_global_binding(object *var);
+long symbol_version(object *var);
+long dep_version(object *var, object *deps);
+object *optimize(object *exp, object *scope, object *proc_env, object **deps);
+object *optimize_sequence(object *exps, object *scope, object *proc_env,
+                          object **deps);
+object *optimize_loop(object *exp, object *scope, object *proc_env,
+                      object **deps);
+object *optimized_body(object *proc);
+char is_frame_binding(object *exp);
+object *eval_frame_binding(object *exp, object *env);
+char is_inline_guard(object *exp);
+object *inline_guard_choice(object *exp);
+
+//futures
+object *make_future(object *exp, object *env);
+char is_future(object *obj);
+char is_future_form(object *exp);
+char claim_future(object *future);
+void run_future(object *future);
+void inject_future(object *future);
+object *take_injected();
+void start_workers();
+object *touch(object *obj);
+char context_waits_on_fd(iota_context *ctx);
+void drain_context(iota_context *ctx);
+
+//channels
+void run_thunk_task(void *arg);
+object *make_channel(long capacity);
+char is_channel(object *obj);
+void channel_wait(waiter **queue);
+void channel_wake(waiter **queue);
+void channel_send(object *ch, object *obj);
+object *channel_recv(object *ch);
+
+//sequences
+object *make_promise(object *exp, object *env);
+char is_promise(object *obj);
+char is_delay(object *exp);
+object *force(object *obj);
+object *make_sequence(seqkind kind, object *proc, object *source, long count);
+char is_sequence(object *obj);
+object *as_sequence(object *obj);
+
+//fasl
+void write_fasl(object *obj, FILE *out);
+object *read_fasl(FILE *in);
+
+//modules
+object *expand(object *exp, object *locals);
 
 //write
 void write_pair(object *cons, object *out_stream, object *env);
@@ -194,11 +454,12 @@ void write(object *obj, object *out_stream, object *env);
 
 //misc
 void error(char *msg);
+void close_fd(int fd);
 void close_stream(object *stream);
 
 //lisp-side procs
 object *error_proc(object *args, object *env);
-object *is_null_proc(object *args, object *env);
+object *is_null_proc(object **args, long argc, object *env);
 object *is_list_proc(object *args, object *env);
 object *is_atom_proc(object *args, object *env);
 object *is_symbol_proc(object *args, object *env);
@@ -206,6 +467,15 @@ object *is_keyword_proc(object *args, object *env);
 object *is_integer_proc(object *args, object *env);
 object *is_char_proc(object *args, object *env);
 object *is_string_proc(object *args, object *env);
+object *string_length_proc(object **args, long argc, object *env);
+object *substring_proc(object **args, long argc, object *env);
+object *string_index_proc(object **args, long argc, object *env);
+object *string_split_proc(object **args, long argc, object *env);
+object *string_prefix_proc(object **args, long argc, object *env);
+object *make_string_builder_proc(object **args, long argc, object *env);
+object *string_builder_append_proc(object **args, long argc, object *env);
+object *string_builder_to_string_proc(object **args, long argc,
+                                      object *env);
 object *is_cons_proc(object *args, object *env);
 object *is_procedure_proc(object *args, object *env);
 object *is_tagged_list_proc(object *args, object *env);
@@ -216,42 +486,98 @@ object *string_to_number_proc(object *args, object *env);
 object *concat_proc(object *args, object *env);
 object *symbol_to_string_proc(object *args, object *env);
 object *string_to_symbol_proc(object *args, object *env);
-object *add_proc(object *args, object *env);
-object *subtract_proc(object *args, object *env);
-object *multiply_proc(object *args, object *env);
-object *divide_proc(object *args, object *env);
-object *is_equal_proc(object *args, object *env);
-object *is_less_than_proc(object *args, object *env);
-object *is_greater_than_proc(object *args, object *env);
-object *cons_proc(object *args, object *env);
-object *car_proc(object *args, object *env);
-object *car_proc(object *args, object *env);
-object *cdr_proc(object *args, object *env);
-object *set_car_proc(object *args, object *env);
-object *set_cdr_proc(object *args, object *env);
+object *add_proc(object **args, long argc, object *env);
+object *subtract_proc(object **args, long argc, object *env);
+object *multiply_proc(object **args, long argc, object *env);
+object *divide_proc(object **args, long argc, object *env);
+object *is_equal_proc(object **args, long argc, object *env);
+object *is_less_than_proc(object **args, long argc, object *env);
+object *is_greater_than_proc(object **args, long argc, object *env);
+object *cons_proc(object **args, long argc, object *env);
+object *car_proc(object **args, long argc, object *env);
+object *cdr_proc(object **args, long argc, object *env);
+object *set_car_proc(object **args, long argc, object *env);
+object *set_cdr_proc(object **args, long argc, object *env);
 object *list_proc(object *args, object *env);
-object *len_proc(object *args, object *env);
-object *is_eq_proc(object *args, object *env);
+object *len_proc(object **args, long argc, object *env);
+object *is_eq_proc(object **args, long argc, object *env);
 object *reverse(object *head);
 object *reverse_proc(object *args, object *env);
+void list_append_item(object **head, object **last, object *item);
+object *call_procedure(object *proc, object *args, object *env);
+object *map_proc(object **args, long argc, object *env);
+object *for_each_proc(object **args, long argc, object *env);
+object *filter_proc(object **args, long argc, object *env);
+object *fold_proc(object **args, long argc, object *env);
+object *append_proc(object **args, long argc, object *env);
+object *assoc_proc(object **args, long argc, object *env);
+object *member_proc(object **args, long argc, object *env);
+object *force_proc(object **args, long argc, object *env);
+object *seq_proc(object **args, long argc, object *env);
+object *seq_map_proc(object **args, long argc, object *env);
+object *seq_filter_proc(object **args, long argc, object *env);
+object *seq_take_proc(object **args, long argc, object *env);
+object *seq_fold_proc(object **args, long argc, object *env);
+object *seq_to_list_proc(object **args, long argc, object *env);
 object *make_file_stream_proc(object *args, object *env);
 object *close_stream_proc(object *args, object *env);
+FILE *stream_arg(object **args, long argc, long i, directiontype direction,
+                 object *env);
+object *read_char_proc(object **args, long argc, object *env);
+object *peek_char_proc(object **args, long argc, object *env);
+object *read_line_proc(object **args, long argc, object *env);
+object *read_bytes_proc(object **args, long argc, object *env);
+object *write_string_proc(object **args, long argc, object *env);
+object *write_char_proc(object **args, long argc, object *env);
+object *is_eof_proc(object **args, long argc, object *env);
+object *write_fasl_proc(object **args, long argc, object *env);
+object *read_fasl_proc(object **args, long argc, object *env);
+object *load_proc(object **args, long argc, object *env);
+object *require_proc(object **args, long argc, object *env);
+object *open_output_string_proc(object **args, long argc, object *env);
+object *open_input_string_proc(object **args, long argc, object *env);
+object *get_output_string_proc(object **args, long argc, object *env);
 object *global_environment_proc(object *args, object *env);
+object *make_dynamic_proc(object *args, object *env);
 object *macroexpand_proc(object *exps, object *env);
 object *apply_proc(object *args, object *env);
 object *eval_proc(object *args, object *env);
 object *read_proc(object *args, object *env);
 object *write_proc(object *args, object *env);
 object *read_proc(object *args, object *env);
+object *touch_proc(object *args, object *env);
+object *is_future_proc(object *args, object *env);
+object *with_budget_proc(object *args, object *env);
+object *spawn_proc(object *args, object *env);
+object *yield_proc(object *args, object *env);
+object *make_channel_proc(object *args, object *env);
+object *is_channel_proc(object *args, object *env);
+object *send_proc(object *args, object *env);
+object *recv_proc(object *args, object *env);
+object *jit_stats_proc(object *args, object *env);
 
 //bootstrap
 #define add_procedure(scheme_name, c_name)      \
   define_variable(make_symbol(scheme_name),     \
                   make_primitive_proc(c_name),  \
                   the_global_environment);
+#define add_array_procedure(scheme_name, c_name, min_args, max_args)   \
+  define_variable(make_symbol(scheme_name),                             \
+                  make_array_primitive_proc(c_name, min_args, max_args), \
+                  the_global_environment);
+void init_runtime();
+void init_globals();
 void init();
+void load_file(char *file_name);
 void read_eval_file(object* in_stream);
 void read_eval_print_file(object *in_stream, object *out_stream);
 void repl();
 
+//contexts
+void context_retain(iota_context *ctx);
+void context_release(iota_context *ctx);
+
+//server
+void serve(int port);
+
 #endif /* BOOTSTRAP_IOTA_H */
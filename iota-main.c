@@ -0,0 +1,32 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "iota-bootstrap.h"
+
+int main(int argc, char **argv) {
+  char bootstrap_code_fname[128] = "bootstrap.l";
+  int port = 0;
+
+  if(argc == 3 && strcmp(argv[1], "--serve") == 0)
+    port = atoi(argv[2]);
+  else if(argc != 1) {
+    fprintf(stderr, "usage: %s [--serve PORT]\n", argv[0]);
+    return 1;
+  }
+
+  printf("Iota-Bootstrap.\n");
+  
+  printf("Initializing core...\n");
+  init();
+  
+  printf("Bootstrapping iota...\n");
+  load_file(bootstrap_code_fname);
+
+  if(port)
+    serve(port);
+  else
+    repl();
+
+  return 0;
+}
@@ -0,0 +1,80 @@
+#ifndef IOTA_H
+#define IOTA_H
+
+// The embedding API, as built into libiota.a and libiota.so.  A context
+// is an isolated interpreter; a process can hold many.  Calls that
+// evaluate return NULL when evaluation fails and iota_error() says why.
+// Link with -lpthread -lm.
+
+#include <stdio.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define IOTA_API __attribute__((visibility("default")))
+
+typedef struct iota_context iota_context;
+typedef struct object iota_object;
+
+// a C primitive: its evaluated arguments and how many there are
+typedef iota_object *iota_primitive(iota_object **args, long argc,
+                                    iota_object *env);
+
+//contexts
+IOTA_API iota_context *iota_open(void);
+// waits for the futures ctx started and runs the calling thread's green
+// threads from ctx while they can go on.  It does not close the ports
+// or sockets ctx opened, and does not free the objects ctx allocated
+// (there is no collector); a green thread still parked, on a channel or
+// on another thread, keeps ctx itself allocated until it ends.
+IOTA_API void iota_close(iota_context *ctx);
+IOTA_API void iota_enter(iota_context *ctx);
+IOTA_API char *iota_error(iota_context *ctx);
+
+//evaluation
+IOTA_API iota_object *iota_eval(iota_context *ctx, iota_object *exp);
+IOTA_API iota_object *iota_eval_string(iota_context *ctx, const char *source);
+IOTA_API iota_object *iota_eval_stream(iota_context *ctx, FILE *in);
+IOTA_API iota_object *iota_load(iota_context *ctx, const char *file_name);
+IOTA_API iota_object *iota_call(iota_context *ctx, iota_object *proc,
+                                long argc, iota_object **args);
+
+//globals
+IOTA_API void iota_define(iota_context *ctx, const char *name,
+                          iota_object *value);
+IOTA_API iota_object *iota_lookup(iota_context *ctx, const char *name);
+// max_args of -1 takes any number
+IOTA_API void iota_define_primitive(iota_context *ctx, const char *name,
+                                    iota_primitive *fn,
+                                    long min_args, long max_args);
+// fail the primitive being run; does not return
+IOTA_API void iota_raise(const char *message);
+
+//values
+IOTA_API iota_object *iota_nil(void);
+IOTA_API iota_object *iota_true(void);
+IOTA_API iota_object *iota_fixnum(long value);
+IOTA_API iota_object *iota_string(const char *chars, size_t length);
+IOTA_API iota_object *iota_symbol(const char *name);
+IOTA_API iota_object *iota_cons(iota_object *car, iota_object *cdr);
+IOTA_API int iota_is_nil(iota_object *obj);
+IOTA_API int iota_is_fixnum(iota_object *obj);
+IOTA_API int iota_is_string(iota_object *obj);
+IOTA_API int iota_is_symbol(iota_object *obj);
+IOTA_API int iota_is_cons(iota_object *obj);
+// these return 0 or NULL when obj is not of their type
+IOTA_API long iota_fixnum_value(iota_object *obj);
+IOTA_API const char *iota_string_value(iota_object *obj, size_t *length);
+IOTA_API const char *iota_symbol_name(iota_object *obj);
+IOTA_API iota_object *iota_car(iota_object *obj);
+IOTA_API iota_object *iota_cdr(iota_object *obj);
+// obj as write prints it, in a string the caller frees
+IOTA_API char *iota_print(iota_object *obj);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* IOTA_H */
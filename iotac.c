@@ -0,0 +1,1008 @@
+#define _GNU_SOURCE
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "iota-bootstrap.h"
+
+// where bootstrap.l, the runtime object and the header live
+#ifndef IOTA_DIR
+#define IOTA_DIR "."
+#endif
+
+/*********************/
+/* compile-time info */
+/*********************/
+
+// A top-level (define (f ...) ...) that nothing else defines or
+// set!s, of a name init() leaves unbound.  Calls to it from compiled
+// code are direct C calls.
+typedef struct function {
+  object *name;
+  object *params;
+  object *body;
+  long required;
+  char rest;
+  char compiled;
+  int id;
+  struct function *next;
+} function;
+
+function *functions = NULL;
+int functions_count = 0;
+
+object *constants;      // (datum . index), emitted as K[index]
+long constants_count = 0;
+object *primitives;     // (symbol . index), emitted as G[index]
+long primitives_count = 0;
+object *builtins;       // (symbol . primitive) as bound by init()
+object *runtime_names;  // every symbol init() binds
+object *definitions;    // (symbol . times defined at top level)
+object *assigned;       // symbols that appear as a set! target
+long locals_count = 0;
+long temps_count = 0;
+char failed = 0;        // the form being compiled used something
+                        // only the interpreter can do
+char tail_called = 0;   // the function being compiled jumps to top
+
+object *global_binding(object *var) {
+  binding *bindings = the_global_environment->data.frame.bindings;
+  long i;
+
+  for(i = 0; i < the_global_environment->data.frame.count; i++)
+    if(bindings[i].name == var)
+      return bindings[i].value;
+  return NULL;
+}
+
+object *assq(object *key, object *alist) {
+  while(!is_nil(alist)) {
+    if(caar(alist) == key)
+      return car(alist);
+    alist = cdr(alist);
+  }
+  return NULL;
+}
+
+char is_redefined(object *var) {
+  return assq(var, definitions) != NULL || is_member(var, assigned);
+}
+
+function *find_function(object *name) {
+  function *fn;
+
+  for(fn = functions; fn; fn = fn->next)
+    if(fn->name == name)
+      return fn;
+  return NULL;
+}
+
+/************/
+/* analysis */
+/************/
+
+void note_assignments(object *exp) {
+  if(!is_cons(exp) || is_quoted(exp))
+    return;
+  if(is_assignment(exp) && is_symbol(cadr(exp)) &&
+     !is_member(cadr(exp), assigned))
+    assigned = cons(cadr(exp), assigned);
+  while(is_cons(exp)) {
+    note_assignments(car(exp));
+    exp = cdr(exp);
+  }
+}
+
+void note_definition(object *exp) {
+  object *entry;
+
+  entry = assq(definition_variable(exp), definitions);
+  if(entry)
+    cdr(entry) = make_fixnum(cdr(entry)->data.fixnum.value + 1);
+  else
+    definitions = cons(cons(definition_variable(exp), make_fixnum(1)),
+                       definitions);
+}
+
+char is_function_definition(object *exp) {
+  object *value;
+
+  if(!is_definition(exp))
+    return 0;
+  if(is_cons(cadr(exp)))
+    return 1;
+  value = caddr(exp);
+  return is_cons(value) && car(value) == lambda_symbol &&
+    (is_nil(cadr(value)) || is_cons(cadr(value)));
+}
+
+void add_function(object *exp) {
+  function *fn;
+  object *name, *params, *body, *iterator;
+  long required = 0;
+  char rest = 0;
+
+  // a define of a name the runtime binds shadows it only once it has
+  // run; calls before that must still reach the runtime's value
+  name = definition_variable(exp);
+  if(cdr(assq(name, definitions))->data.fixnum.value != 1 ||
+     is_member(name, assigned) || is_member(name, runtime_names) ||
+     find_function(name))
+    return;
+  if(is_cons(cadr(exp))) {
+    params = cdadr(exp);
+    body = cddr(exp);
+  }
+  else {
+    params = cadr(caddr(exp));
+    body = cddr(caddr(exp));
+  }
+  for(iterator = params; is_cons(iterator); iterator = cdr(iterator)) {
+    if(car(iterator) == rest_keyword) {
+      if(!is_cons(cdr(iterator)) || !is_symbol(cadr(iterator)) ||
+         !is_nil(cddr(iterator)))
+        return;
+      rest = 1;
+      break;
+    }
+    if(!is_symbol(car(iterator)))
+      return;
+    required++;
+  }
+  if(!is_nil(iterator) && !rest)
+    return;
+
+  fn = malloc(sizeof(function));
+  if(!fn)
+    error("Could not allocate function.");
+  fn->name = name;
+  fn->params = parse_params(params);
+  fn->body = body;
+  fn->required = required;
+  fn->rest = rest;
+  fn->compiled = 1;
+  fn->id = functions_count++;
+  fn->next = functions;
+  functions = fn;
+}
+
+/************/
+/* emission */
+/************/
+
+void emit_c_string(FILE *out, char *s) {
+  fputc('"', out);
+  for(; *s; s++) {
+    if(*s == '"' || *s == '\\')
+      fprintf(out, "\\%c", *s);
+    else if(*s < ' ' || *s > '~')
+      fprintf(out, "\\%03o", (unsigned char) *s);
+    else
+      fputc(*s, out);
+  }
+  fputc('"', out);
+}
+
+void emit_datum(FILE *out, object *obj) {
+  switch(obj->type) {
+  case NIL:
+    fprintf(out, "nil");
+    break;
+  case SYMBOL:
+    fprintf(out, "make_symbol(");
+    emit_c_string(out, obj->data.symbol.value);
+    fprintf(out, ")");
+    break;
+  case KEYWORD:
+    fprintf(out, "make_keyword(");
+    emit_c_string(out, obj->data.keyword.value);
+    fprintf(out, ")");
+    break;
+  case FIXNUM:
+    fprintf(out, "make_fixnum(%ldL)", obj->data.fixnum.value);
+    break;
+  case CHARACTER:
+    fprintf(out, "make_character((char) %d)", obj->data.character.value);
+    break;
+  case STRING:
+    fprintf(out, "make_string(");
+    emit_c_string(out, string_cstr(obj));
+    fprintf(out, ")");
+    break;
+  case CONS:
+    fprintf(out, "cons(");
+    emit_datum(out, car(obj));
+    fprintf(out, ",\n    ");
+    emit_datum(out, cdr(obj));
+    fprintf(out, ")");
+    break;
+  default:
+    error("iotac: cannot emit a constant of this type.");
+  }
+}
+
+long constant(object *obj) {
+  object *entry;
+
+  if((entry = assq(obj, constants)))
+    return cdr(entry)->data.fixnum.value;
+  constants = cons(cons(obj, make_fixnum(constants_count)), constants);
+  return constants_count++;
+}
+
+long primitive(object *var) {
+  object *entry;
+
+  if((entry = assq(var, primitives)))
+    return cdr(entry)->data.fixnum.value;
+  primitives = cons(cons(var, make_fixnum(primitives_count)), primitives);
+  return primitives_count++;
+}
+
+long local(object *var, object *scope) {
+  object *entry;
+
+  entry = assq(var, scope);
+  return entry ? cdr(entry)->data.fixnum.value : -1;
+}
+
+void compile(FILE *out, object *exp, object *scope, function *self, char tail);
+char is_simple(object *exp, object *scope);
+
+// values before the last are dropped, so simple ones are not emitted
+void compile_sequence(FILE *out, object *exps, object *scope,
+                      function *self, char tail) {
+  if(is_nil(exps)) {
+    fprintf(out, "nil");
+    return;
+  }
+  if(is_nil(cdr(exps))) {
+    compile(out, car(exps), scope, self, tail);
+    return;
+  }
+  fprintf(out, "({ ");
+  for(; !is_nil(cdr(exps)); exps = cdr(exps)) {
+    if(is_nil(car(exps)) || is_simple(car(exps), scope))
+      continue;
+    compile(out, car(exps), scope, self, 0);
+    fprintf(out, "; ");
+  }
+  compile(out, car(exps), scope, self, tail);
+  fprintf(out, "; })");
+}
+
+void compile_let(FILE *out, object *exp, object *scope,
+                 function *self, char tail) {
+  object *bindings, *inner;
+
+  inner = scope;
+  fprintf(out, "({ ");
+  for(bindings = cadr(exp); !is_nil(bindings); bindings = cdr(bindings)) {
+    // *stdout* and *stdin* are dynamic; a let cannot rebind them
+    if(caar(bindings) == stdout_symbol || caar(bindings) == stdin_symbol ||
+       !is_symbol(caar(bindings)))
+      failed = 1;
+    fprintf(out, "object *l%ld = ", locals_count);
+    compile(out, cadar(bindings), scope, self, 0);
+    fprintf(out, "; ");
+    inner = cons(cons(caar(bindings), make_fixnum(locals_count++)), inner);
+  }
+  compile_sequence(out, cddr(exp), inner, self, tail);
+  fprintf(out, "; })");
+}
+
+void compile_while(FILE *out, object *exp, object *scope, function *self) {
+  fprintf(out, "({ while(!iota_false(");
+  compile(out, cadr(exp), scope, self, 0);
+  fprintf(out, ")) { consume_fuel(); ");
+  if(!is_nil(cddr(exp))) {
+    compile_sequence(out, cddr(exp), scope, self, 0);
+    fprintf(out, "; ");
+  }
+  fprintf(out, "} nil; })");
+}
+
+// the loop variables become locals; steps go to temporaries first so
+// that each sees the values from the round before
+void compile_loop(FILE *out, object *exp, object *scope, function *self) {
+  object *specs, *inner, *clause, *temps = nil;
+  long first;
+
+  if(!is_cons(cddr(exp)) || !is_cons(caddr(exp))) {
+    failed = 1;
+    return;
+  }
+  clause = caddr(exp);
+  inner = scope;
+  first = locals_count;
+  fprintf(out, "({ ");
+  for(specs = cadr(exp); is_cons(specs); specs = cdr(specs)) {
+    if(!is_cons(car(specs)) || !is_symbol(caar(specs)) ||
+       !is_cons(cdar(specs))) {
+      failed = 1;
+      return;
+    }
+    fprintf(out, "object *l%ld = ", locals_count);
+    compile(out, cadar(specs), scope, self, 0);
+    fprintf(out, "; ");
+    inner = cons(cons(caar(specs), make_fixnum(locals_count++)), inner);
+  }
+  fprintf(out, "while(iota_false(");
+  compile(out, car(clause), inner, self, 0);
+  fprintf(out, ")) { consume_fuel(); ");
+  if(!is_nil(cdddr(exp))) {
+    compile_sequence(out, cdddr(exp), inner, self, 0);
+    fprintf(out, "; ");
+  }
+  for(specs = cadr(exp); is_cons(specs); specs = cdr(specs)) {
+    if(is_nil(cddar(specs)))
+      continue;
+    fprintf(out, "object *l%ld = ", locals_count);
+    compile(out, car(cddar(specs)), inner, self, 0);
+    fprintf(out, "; ");
+    temps = cons(make_fixnum(locals_count++), temps);
+  }
+  temps = reverse(temps);
+  for(specs = cadr(exp); is_cons(specs); specs = cdr(specs), first++) {
+    if(is_nil(cddar(specs)))
+      continue;
+    fprintf(out, "l%ld = l%ld; ", first, car(temps)->data.fixnum.value);
+    temps = cdr(temps);
+  }
+  fprintf(out, "} ");
+  if(is_nil(cdr(clause)))
+    fprintf(out, "nil");
+  else
+    compile_sequence(out, cdr(clause), inner, self, 0);
+  fprintf(out, "; })");
+}
+
+char is_simple(object *exp, object *scope) {
+  return is_self_evaluating(exp) || is_quoted(exp) ||
+    (is_symbol(exp) && local(exp, scope) >= 0);
+}
+
+// Evaluate args left to right into temporaries; simple args are
+// re-emitted in place.  Leaves a statement expression open when any
+// temporary was needed and returns the temporary ids (0 for none).
+long *compile_args(FILE *out, object *args, object *scope,
+                   function *self, char force, char *opened) {
+  long *temps;
+  long i, argc;
+
+  argc = len(args);
+  temps = calloc(argc + 1, sizeof(long));
+  *opened = 0;
+  for(i = 0; i < argc; i++, args = cdr(args)) {
+    if(!force && is_simple(car(args), scope))
+      continue;
+    if(!*opened) {
+      fprintf(out, "({ ");
+      *opened = 1;
+    }
+    temps[i] = ++temps_count;
+    fprintf(out, "object *t%ld = ", temps[i]);
+    compile(out, car(args), scope, self, 0);
+    fprintf(out, "; ");
+  }
+  return temps;
+}
+
+void emit_arg(FILE *out, object *args, long i, long *temps,
+              object *scope, function *self) {
+  long n;
+
+  if(temps[i]) {
+    fprintf(out, "t%ld", temps[i]);
+    return;
+  }
+  for(n = 0; n < i; n++)
+    args = cdr(args);
+  compile(out, car(args), scope, self, 0);
+}
+
+void emit_list(FILE *out, object *args, long from, long *temps,
+               object *scope, function *self) {
+  long i, argc;
+
+  argc = len(args);
+  for(i = 0; i < from; i++)
+    args = cdr(args);
+  for(; i < argc; i++, args = cdr(args)) {
+    fprintf(out, "cons(");
+    emit_arg(out, args, 0, temps + i, scope, self);
+    fprintf(out, ", ");
+  }
+  fprintf(out, "nil");
+  for(i = from; i < argc; i++)
+    fprintf(out, ")");
+}
+
+void close_args(FILE *out, long *temps, char opened) {
+  if(opened)
+    fprintf(out, "; })");
+  free(temps);
+}
+
+// primitives with an inline fast path in the generated prelude
+struct {
+  char *name;
+  long argc;
+  char *helper;
+} inlined[] = {
+  {"+", 2, "iota_add"},
+  {"-", 2, "iota_subtract"},
+  {"*", 2, "iota_multiply"},
+  {"<", 2, "iota_less_than"},
+  {">", 2, "iota_greater_than"},
+  {"=", 2, "iota_equal"},
+  {"eq?", 2, "iota_eq"},
+  {"cons", 2, "cons"},
+  {"car", 1, "iota_first"},
+  {"cdr", 1, "iota_rest"},
+  {"null?", 1, "iota_null"},
+  {"nil?", 1, "iota_null"},
+  {NULL, 0, NULL}
+};
+
+void compile_application(FILE *out, object *exp, object *scope,
+                         function *self, char tail) {
+  object *op, *args, *proc;
+  function *fn;
+  long *temps, argc, i, p;
+  char opened;
+
+  op = car(exp);
+  args = cdr(exp);
+  argc = len(args);
+
+  if(is_symbol(op) && local(op, scope) < 0) {
+    fn = find_function(op);
+    if(fn && fn->compiled &&
+       (argc == fn->required || (fn->rest && argc > fn->required))) {
+      if(tail && fn == self) {
+        temps = compile_args(out, args, scope, self, 1, &opened);
+        if(!opened)
+          fprintf(out, "({ ");
+        for(i = 0, p = 0; i < fn->required; i++)
+          fprintf(out, "l%ld = t%ld; ", i, temps[i]);
+        if(fn->rest) {
+          fprintf(out, "l%ld = ", fn->required);
+          emit_list(out, args, fn->required, temps, scope, self);
+          fprintf(out, "; ");
+        }
+        fprintf(out, "goto top; nil; })");
+        tail_called = 1;
+        free(temps);
+        return;
+      }
+      temps = compile_args(out, args, scope, self, 0, &opened);
+      fprintf(out, "f%d(", fn->id);
+      for(i = 0; i < fn->required; i++) {
+        if(i)
+          fprintf(out, ", ");
+        emit_arg(out, args, i, temps, scope, self);
+      }
+      if(fn->rest) {
+        if(fn->required)
+          fprintf(out, ", ");
+        emit_list(out, args, fn->required, temps, scope, self);
+      }
+      fprintf(out, ")");
+      close_args(out, temps, opened);
+      return;
+    }
+
+    proc = assq(op, builtins);
+    if(proc && !is_redefined(op)) {
+      proc = cdr(proc);
+      if(proc->data.primitive_proc.fn == eval_proc && argc <= 2) {
+        temps = compile_args(out, args, scope, self, 0, &opened);
+        fprintf(out, "eval(");
+        emit_arg(out, args, 0, temps, scope, self);
+        fprintf(out, ", ");
+        if(argc == 2)
+          emit_arg(out, args, 1, temps, scope, self);
+        else
+          fprintf(out, "the_global_environment");
+        fprintf(out, ")");
+        close_args(out, temps, opened);
+        return;
+      }
+      if(proc->data.primitive_proc.fn == apply_proc && argc >= 2) {
+        temps = compile_args(out, args, scope, self, 0, &opened);
+        fprintf(out, "iota_apply(");
+        emit_arg(out, args, 0, temps, scope, self);
+        fprintf(out, ", prepare_args_for_apply(");
+        emit_list(out, args, 1, temps, scope, self);
+        fprintf(out, "))");
+        close_args(out, temps, opened);
+        return;
+      }
+      for(i = 0; inlined[i].name; i++) {
+        if(strcmp(inlined[i].name, op->data.symbol.value) == 0 &&
+           inlined[i].argc == argc) {
+          temps = compile_args(out, args, scope, self, 0, &opened);
+          fprintf(out, "%s(", inlined[i].helper);
+          for(p = 0; p < argc; p++) {
+            if(p)
+              fprintf(out, ", ");
+            emit_arg(out, args, p, temps, scope, self);
+          }
+          fprintf(out, ")");
+          close_args(out, temps, opened);
+          return;
+        }
+      }
+      temps = compile_args(out, args, scope, self, 0, &opened);
+      if(proc->data.primitive_proc.array_fn) {
+        // arguments in a compound literal, nothing consed
+        fprintf(out, "call_array_primitive(G[%ld], ", primitive(op));
+        if(argc == 0)
+          fprintf(out, "NULL");
+        else {
+          fprintf(out, "(object *[]){");
+          for(p = 0; p < argc; p++) {
+            if(p)
+              fprintf(out, ", ");
+            emit_arg(out, args, p, temps, scope, self);
+          }
+          fprintf(out, "}");
+        }
+        fprintf(out, ", %ld, the_global_environment)", argc);
+      }
+      else {
+        fprintf(out, "G[%ld]->data.primitive_proc.fn(", primitive(op));
+        emit_list(out, args, 0, temps, scope, self);
+        fprintf(out, ", the_global_environment)");
+      }
+      close_args(out, temps, opened);
+      return;
+    }
+  }
+
+  // anything else goes through apply on the operator's value
+  temps = compile_args(out, exp, scope, self, 1, &opened);
+  fprintf(out, "iota_apply(t%ld, ", temps[0]);
+  emit_list(out, exp, 1, temps, scope, self);
+  fprintf(out, ")");
+  close_args(out, temps, opened);
+}
+
+void compile(FILE *out, object *exp, object *scope, function *self, char tail) {
+  long l;
+
+  if(is_nil(exp)) {
+    fprintf(out, "nil");
+  }
+  else if(is_self_evaluating(exp)) {
+    fprintf(out, "K[%ld]", constant(exp));
+  }
+  else if(is_symbol(exp)) {
+    if((l = local(exp, scope)) >= 0)
+      fprintf(out, "l%ld", l);
+    else if(exp == t_symbol && !is_redefined(exp))
+      fprintf(out, "t_symbol");
+    else
+      fprintf(out, "lookup_variable_value(K[%ld], the_global_environment)",
+              constant(exp));
+  }
+  else if(!is_cons(exp)) {
+    failed = 1;
+  }
+  else if(is_symbol(car(exp)) && local(car(exp), scope) >= 0) {
+    compile_application(out, exp, scope, self, tail);
+  }
+  else if(is_quoted(exp)) {
+    fprintf(out, "K[%ld]", constant(text_of_quotation(exp)));
+  }
+  else if(is_if(exp)) {
+    fprintf(out, "(!iota_false(");
+    compile(out, if_predicate(exp), scope, self, 0);
+    fprintf(out, ") ? ");
+    compile(out, if_consequent(exp), scope, self, tail);
+    fprintf(out, " : ");
+    if(is_nil(cdddr(exp)))
+      fprintf(out, "nil");
+    else
+      compile(out, if_alternative(exp), scope, self, tail);
+    fprintf(out, ")");
+  }
+  else if(is_cond(exp)) {
+    compile(out, cond_to_if(exp), scope, self, tail);
+  }
+  else if(is_let(exp)) {
+    compile_let(out, exp, scope, self, tail);
+  }
+  else if(is_while(exp)) {
+    compile_while(out, exp, scope, self);
+  }
+  else if(is_loop(exp)) {
+    compile_loop(out, exp, scope, self);
+  }
+  else if(is_begin(exp)) {
+    compile_sequence(out, begin_actions(exp), scope, self, tail);
+  }
+  else if(is_assignment(exp)) {
+    if((l = local(cadr(exp), scope)) >= 0) {
+      fprintf(out, "(l%ld = ", l);
+      compile(out, caddr(exp), scope, self, 0);
+      fprintf(out, ", K[%ld])", constant(cadr(exp)));
+    }
+    else {
+      fprintf(out, "({ set_variable_value(K[%ld], ", constant(cadr(exp)));
+      compile(out, caddr(exp), scope, self, 0);
+      fprintf(out, ", the_global_environment); K[%ld]; })",
+              constant(cadr(exp)));
+    }
+  }
+  else if(is_definition(exp) || is_lambda(exp) || is_macro_def(exp) ||
+          is_backquoted(exp) || is_piped(exp) || is_future_form(exp) ||
+          is_delay(exp) || is_dynamic_let(exp)) {
+    // closures and the rest are left to the interpreter
+    failed = 1;
+  }
+  else {
+    compile_application(out, exp, scope, self, tail);
+  }
+}
+
+// the body goes to a buffer first: only a function that calls itself
+// in tail position gets the top label
+void compile_function(FILE *out, function *fn) {
+  object *scope, *params;
+  char *body;
+  size_t size;
+  FILE *stream;
+
+  scope = nil;
+  locals_count = 0;
+  fprintf(out, "// %s\nstatic object *f%d(", fn->name->data.symbol.value,
+          fn->id);
+  for(params = fn->params; !is_nil(params); params = cdr(params)) {
+    if(locals_count)
+      fprintf(out, ", ");
+    fprintf(out, "object *l%ld", locals_count);
+    scope = cons(cons(car(params), make_fixnum(locals_count++)), scope);
+  }
+  if(!locals_count)
+    fprintf(out, "void");
+  tail_called = 0;
+  stream = open_memstream(&body, &size);
+  compile_sequence(stream, fn->body, scope, fn, 1);
+  fclose(stream);
+  fprintf(out, ") {\n%s  consume_fuel();\n  return %s;\n}\n\n",
+          tail_called ? " top:\n" : "", body);
+  free(body);
+}
+
+void compile_wrapper(FILE *out, function *fn) {
+  long i;
+
+  fprintf(out, "static object *f%d_proc(object *args, object *env) {\n",
+          fn->id);
+  for(i = 0; i < fn->required; i++)
+    fprintf(out, "  object *a%ld = iota_next_arg(&args);\n", i);
+  fprintf(out, "  return f%d(", fn->id);
+  for(i = 0; i < fn->required; i++)
+    fprintf(out, "%sa%ld", i ? ", " : "", i);
+  if(fn->rest)
+    fprintf(out, "%sargs", fn->required ? ", " : "");
+  fprintf(out, ");\n}\n\n");
+}
+
+// Compile a top-level form into a statement of iota_program(),
+// falling back to handing the form to eval.
+void compile_toplevel(FILE *out, object *exp) {
+  function *fn;
+  object *saved_constants;
+  long saved_count;
+  char *buffer;
+  size_t size;
+  FILE *stmt;
+
+  if(is_definition(exp) && (fn = find_function(definition_variable(exp))) &&
+     fn->compiled) {
+    fprintf(out, "  define_variable(K[%ld], make_primitive_proc(f%d_proc), "
+            "the_global_environment);\n",
+            constant(fn->name), fn->id);
+    return;
+  }
+
+  // a constant on its own does nothing once compiled
+  if(is_nil(exp) || is_simple(exp, nil))
+    return;
+  saved_constants = constants;
+  saved_count = constants_count;
+  failed = 0;
+  stmt = open_memstream(&buffer, &size);
+  if(is_definition(exp) && is_symbol(cadr(exp))) {
+    fprintf(stmt, "  define_variable(K[%ld], ", constant(cadr(exp)));
+    compile(stmt, caddr(exp), nil, NULL, 0);
+    fprintf(stmt, ", the_global_environment);\n");
+  }
+  else {
+    fprintf(stmt, "  ");
+    compile(stmt, exp, nil, NULL, 0);
+    fprintf(stmt, ";\n");
+  }
+  fclose(stmt);
+  if(failed) {
+    constants = saved_constants;
+    constants_count = saved_count;
+    fprintf(out, "  eval(K[%ld], the_global_environment);\n", constant(exp));
+  }
+  else
+    fputs(buffer, out);
+  free(buffer);
+}
+
+/***********/
+/* prelude */
+/***********/
+
+char *prelude =
+  "#define iota_false(X) ((X)->type == NIL)\n"
+  "#define iota_both_fixnums(A, B) ((A)->type == FIXNUM && (B)->type == FIXNUM)\n"
+  "#define iota_pair(A, B) cons(A, cons(B, nil))\n"
+  "\n"
+  "static inline object *iota_add(object *a, object *b) {\n"
+  "  if(iota_both_fixnums(a, b))\n"
+  "    return make_fixnum(a->data.fixnum.value + b->data.fixnum.value);\n"
+  "  return add_proc((object *[]){a, b}, 2, the_global_environment);\n"
+  "}\n"
+  "\n"
+  "static inline object *iota_subtract(object *a, object *b) {\n"
+  "  if(iota_both_fixnums(a, b))\n"
+  "    return make_fixnum(a->data.fixnum.value - b->data.fixnum.value);\n"
+  "  return subtract_proc((object *[]){a, b}, 2, the_global_environment);\n"
+  "}\n"
+  "\n"
+  "static inline object *iota_multiply(object *a, object *b) {\n"
+  "  if(iota_both_fixnums(a, b))\n"
+  "    return make_fixnum(a->data.fixnum.value * b->data.fixnum.value);\n"
+  "  return multiply_proc((object *[]){a, b}, 2, the_global_environment);\n"
+  "}\n"
+  "\n"
+  "static inline object *iota_less_than(object *a, object *b) {\n"
+  "  if(iota_both_fixnums(a, b))\n"
+  "    return a->data.fixnum.value < b->data.fixnum.value ? t_symbol : nil;\n"
+  "  return is_less_than_proc((object *[]){a, b}, 2, the_global_environment);\n"
+  "}\n"
+  "\n"
+  "static inline object *iota_greater_than(object *a, object *b) {\n"
+  "  if(iota_both_fixnums(a, b))\n"
+  "    return a->data.fixnum.value > b->data.fixnum.value ? t_symbol : nil;\n"
+  "  return is_greater_than_proc((object *[]){a, b}, 2, the_global_environment);\n"
+  "}\n"
+  "\n"
+  "static inline object *iota_equal(object *a, object *b) {\n"
+  "  if(iota_both_fixnums(a, b))\n"
+  "    return a->data.fixnum.value == b->data.fixnum.value ? t_symbol : nil;\n"
+  "  return is_equal_proc((object *[]){a, b}, 2, the_global_environment);\n"
+  "}\n"
+  "\n"
+  "static inline object *iota_eq(object *a, object *b) {\n"
+  "  return is_eq(a, b) ? t_symbol : nil;\n"
+  "}\n"
+  "\n"
+  "static inline object *iota_first(object *a) {\n"
+  "  return car(a);\n"
+  "}\n"
+  "\n"
+  "static inline object *iota_rest(object *a) {\n"
+  "  return cdr(a);\n"
+  "}\n"
+  "\n"
+  "static inline object *iota_null(object *a) {\n"
+  "  return iota_false(a) ? t_symbol : nil;\n"
+  "}\n"
+  "\n"
+  "static inline object *iota_next_arg(object **args) {\n"
+  "  object *arg;\n"
+  "\n"
+  "  if(iota_false(*args))\n"
+  "    return nil;\n"
+  "  arg = car(*args);\n"
+  "  *args = cdr(*args);\n"
+  "  return arg;\n"
+  "}\n"
+  "\n"
+  "// macros reached through a variable get their already evaluated\n"
+  "// arguments quoted\n"
+  "static object *iota_apply(object *proc, object *args) {\n"
+  "  object *quoted;\n"
+  "\n"
+  "  if(is_macro(proc)) {\n"
+  "    for(quoted = nil; !iota_false(args); args = cdr(args))\n"
+  "      quoted = cons(iota_pair(quote_symbol, car(args)), quoted);\n"
+  "    return eval(macroexpand(proc, reverse(quoted)), the_global_environment);\n"
+  "  }\n"
+  "  if(is_primitive_proc(proc) && proc->data.primitive_proc.fn == eval_proc)\n"
+  "    return eval(car(args), iota_false(cdr(args)) ?\n"
+  "                the_global_environment : cadr(args));\n"
+  "  if(is_primitive_proc(proc) && proc->data.primitive_proc.fn == apply_proc)\n"
+  "    return iota_apply(car(args), prepare_args_for_apply(cdr(args)));\n"
+  "  return apply(proc, args, the_global_environment);\n"
+  "}\n"
+  "\n";
+
+/********/
+/* main */
+/********/
+
+object *read_forms(char *fname, object *forms) {
+  object *stream, *obj;
+
+  stream = make_file_stream(fname, INPUT);
+  while((obj = read(stream, the_global_environment)) != eof_object)
+    forms = cons(obj, forms);
+  close_stream(stream);
+  return forms;
+}
+
+void write_program(FILE *out, char *source, object *forms) {
+  function *fn;
+  object *iterator;
+  char *body, *program;
+  size_t body_size, program_size;
+  FILE *stream;
+
+  // a dry run finds the functions compiled code can call directly
+  for(fn = functions; fn; fn = fn->next) {
+    failed = 0;
+    stream = open_memstream(&body, &body_size);
+    compile_function(stream, fn);
+    fclose(stream);
+    free(body);
+    fn->compiled = !failed;
+  }
+  constants = nil;
+  constants_count = 0;
+  primitives = nil;
+  primitives_count = 0;
+
+  stream = open_memstream(&body, &body_size);
+  for(fn = functions; fn; fn = fn->next) {
+    if(!fn->compiled)
+      continue;
+    failed = 0;
+    compile_function(stream, fn);
+    compile_wrapper(stream, fn);
+  }
+  fclose(stream);
+
+  stream = open_memstream(&program, &program_size);
+  for(iterator = forms; !is_nil(iterator); iterator = cdr(iterator))
+    compile_toplevel(stream, car(iterator));
+  fclose(stream);
+
+  fprintf(out, "// compiled by iotac from %s\n\n", source);
+  fprintf(out, "#include <iota-bootstrap.h>\n\n");
+  fprintf(out, "static object *K[%ld];\n", constants_count + 1);
+  fprintf(out, "static object *G[%ld];\n\n", primitives_count + 1);
+  fputs(prelude, out);
+  for(fn = functions; fn; fn = fn->next)
+    if(fn->compiled)
+      fprintf(out, "static object *f%d();\n", fn->id);
+  fprintf(out, "\n");
+  fputs(body, out);
+
+  fprintf(out, "static void iota_constants() {\n");
+  for(iterator = constants; !is_nil(iterator); iterator = cdr(iterator)) {
+    fprintf(out, "  K[%ld] = ", cdar(iterator)->data.fixnum.value);
+    emit_datum(out, caar(iterator));
+    fprintf(out, ";\n");
+  }
+  for(iterator = primitives; !is_nil(iterator); iterator = cdr(iterator)) {
+    fprintf(out, "  G[%ld] = lookup_variable_value(make_symbol(",
+            cdar(iterator)->data.fixnum.value);
+    emit_c_string(out, caar(iterator)->data.symbol.value);
+    fprintf(out, "), the_global_environment);\n");
+  }
+  fprintf(out, "}\n\n");
+
+  fprintf(out, "static void iota_program() {\n");
+  fputs(program, out);
+  fprintf(out, "}\n\n");
+
+  fprintf(out,
+          "int main(int argc, char **argv) {\n"
+          "  init();\n"
+          "  iota_constants();\n"
+          "  iota_program();\n"
+          "  fflush(stdout);\n"
+          "  return 0;\n"
+          "}\n");
+  free(body);
+  free(program);
+}
+
+int main(int argc, char **argv) {
+  char *source = NULL, *output = NULL, *c_file, *command, *cc;
+  char emit_c = 0;
+  object *forms, *iterator, *expanded;
+  binding *bindings;
+  FILE *out;
+  size_t n;
+  int i, status;
+
+  for(i = 1; i < argc; i++) {
+    if(strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+      output = argv[++i];
+    else if(strcmp(argv[i], "--emit-c") == 0)
+      emit_c = 1;
+    else if(!source && argv[i][0] != '-')
+      source = argv[i];
+    else
+      source = NULL, i = argc;
+  }
+  if(!source) {
+    fprintf(stderr, "usage: %s [--emit-c] [-o OUTPUT] FILE.l\n", argv[0]);
+    return 1;
+  }
+  if(!output) {
+    n = strlen(source);
+    output = strdup(source);
+    if(n > 2 && strcmp(source + n - 2, ".l") == 0)
+      output[n - 2] = '\0';
+    else
+      output = "a.out";
+    if(emit_c) {
+      c_file = malloc(strlen(output) + 3);
+      sprintf(c_file, "%s.c", output);
+      output = c_file;
+    }
+  }
+
+  init();
+  constants = primitives = builtins = definitions = assigned = nil;
+  runtime_names = nil;
+  bindings = the_global_environment->data.frame.bindings;
+  for(i = 0; i < the_global_environment->data.frame.count; i++) {
+    runtime_names = cons(bindings[i].name, runtime_names);
+    if(is_primitive_proc(bindings[i].value))
+      builtins = cons(cons(bindings[i].name, bindings[i].value), builtins);
+  }
+
+  // the runtime library is compiled along with the program; its
+  // definitions (and the program's) are evaluated now so that later
+  // forms can use the macros they define
+  forms = read_forms(IOTA_DIR "/bootstrap.l", nil);
+  forms = reverse(read_forms(source, forms));
+  for(iterator = forms; !is_nil(iterator); iterator = cdr(iterator)) {
+    expanded = expand(car(iterator), nil);
+    car(iterator) = expanded;
+    if(is_definition(expanded)) {
+      note_definition(expanded);
+      eval(expanded, the_global_environment);
+    }
+    note_assignments(expanded);
+  }
+  for(iterator = forms; !is_nil(iterator); iterator = cdr(iterator))
+    if(is_function_definition(car(iterator)))
+      add_function(car(iterator));
+
+  c_file = emit_c ? output : malloc(strlen(output) + 3);
+  if(!emit_c)
+    sprintf(c_file, "%s.c", output);
+  out = fopen(c_file, "w");
+  if(!out) {
+    fprintf(stderr, "iotac: cannot write %s\n", c_file);
+    return 1;
+  }
+  write_program(out, source, forms);
+  fclose(out);
+  if(emit_c)
+    return 0;
+
+  cc = getenv("CC") ? getenv("CC") : "cc";
+  command = malloc(strlen(cc) + 2 * strlen(IOTA_DIR) + strlen(output) +
+                   strlen(c_file) + 128);
+  sprintf(command, "%s -O2 -I'%s' -o '%s' '%s' '%s/iota-bootstrap.o' -lm -lpthread",
+          cc, IOTA_DIR, output, c_file, IOTA_DIR);
+  status = system(command);
+  remove(c_file);
+  return status == 0 ? 0 : 1;
+}
@@ -0,0 +1,39 @@
+#!/bin/bash
+# Every program under tests/jit must print the same with the JIT off as
+# with it compiling procedures on their first or on their second call;
+# by the second, closures made by the first carry optimized bodies.
+# A program ends by evaluating 'end; the script then feeds the REPL an
+# unbound name so that it exits.
+#
+#   tests/jit-differential.sh [iota binary]
+
+iota=${1:-./iota}
+dir=$(dirname "$0")/jit
+out=$(mktemp -d)
+trap 'rm -rf $out' EXIT
+status=0
+
+run() {
+  { cat "$2"; echo end-of-test; } |
+    IOTA_JIT_THRESHOLD=$1 timeout 20 $iota > $out/$1.out 2>&1
+}
+
+for program in $dir/*.l; do
+  run 0 $program
+  if ! grep -qx '=> end' $out/0.out; then
+    echo "FAIL: $program does not run to the end when interpreted"
+    status=1
+    continue
+  fi
+  for threshold in 1 2; do
+    run $threshold $program
+    if ! diff -u $out/0.out $out/$threshold.out > $out/diff; then
+      echo "FAIL: $program prints differently at threshold $threshold"
+      cat $out/diff
+      status=1
+      continue 2
+    fi
+  done
+  echo "ok: $program"
+done
+exit $status
@@ -0,0 +1,35 @@
+#!/bin/bash
+# A busy client must not hold up another one: while the first client
+# runs a long loop, the second's (+ 40 2) should come back well before
+# the loop ends.
+#
+#   tests/serve-fairness.sh [iota binary] [port]
+
+iota=${1:-./iota}
+port=${2:-4777}
+limit_ms=500
+
+$iota --serve $port > /dev/null 2>&1 &
+server=$!
+trap 'kill $server 2> /dev/null' EXIT
+sleep 0.5
+
+exec 3<> /dev/tcp/127.0.0.1/$port
+printf '(define i 0)\n(while (< i 3000000) (set! i (+ i 1)))\n' >&3
+sleep 0.2
+
+exec 4<> /dev/tcp/127.0.0.1/$port
+start=$(date +%s%N)
+printf '(+ 40 2)\n' >&4
+read -t 10 answer <&4
+elapsed=$(( ($(date +%s%N) - start) / 1000000 ))
+
+if [ "$answer" != "42" ]; then
+  echo "FAIL: second client got '$answer'"
+  exit 1
+fi
+if [ $elapsed -gt $limit_ms ]; then
+  echo "FAIL: second client waited ${elapsed}ms behind a busy one"
+  exit 1
+fi
+echo "ok: second client answered in ${elapsed}ms"